@@ -5,7 +5,431 @@
 #include <thread>
 #include <sstream>
 #include <stdexcept>
+#include <exception>
 #include <chrono>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <cmath>
+#include <climits>
+#include <array>
+#include <limits>
+#include <map>
+#include <set>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <charconv>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <cerrno>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+/**
+ * Fires a USDT probe in the happynumbers provider, which is a single nop unless a tracer is attached
+ */
+#define HN_PROBE(...) STAP_PROBEV(happynumbers, __VA_ARGS__)
+#else
+#define HN_PROBE(...) ((void)0)
+#endif
+
+/**
+ * A prime modulus for number-theoretic transforms along with one of its primitive roots
+ */
+struct NttPrime {
+    std::uint32_t modulus;
+    std::uint32_t root;
+};
+
+/**
+ * Primes used as moduli for number-theoretic transforms, each one more than a multiple of 2^27
+ *
+ * Convolutions are calculated modulo each of them and combined with the Chinese remainder theorem, so they are exact
+ * below the product of the primes (about 1.48*10^28)
+ */
+constexpr std::array<NttPrime,3> NTT_PRIMES = {{{2013265921, 31}, {2281701377, 3}, {3221225473, 5}}};
+/**
+ * The most points a transform modulo every one of NTT_PRIMES can have
+ */
+constexpr std::size_t NTT_MAX_SIZE = 1 << 27;
+
+/**
+ * Raises a given base to a given power modulo a given modulus
+ *
+ * @param base The value being raised
+ * @param exponent The power to raise base to
+ * @param modulus The modulus, which must be below 2^32
+ * @return base^exponent mod modulus
+ */
+constexpr std::uint32_t powMod(std::uint64_t base, std::uint64_t exponent, const std::uint64_t &modulus) {
+    std::uint64_t result = 1;
+    base %= modulus;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result = result*base % modulus;
+        }
+        base = base*base % modulus;
+        exponent >>= 1;
+    }
+    return static_cast<std::uint32_t>(result);
+}
+
+/**
+ * Performs an in-place number-theoretic transform modulo a given prime
+ *
+ * @param values The coefficients to transform; the size must be a power of two no more than NTT_MAX_SIZE
+ * @param inverse Whether to perform the inverse transform
+ * @param prime The prime to transform modulo
+ */
+void ntt(std::vector<std::uint32_t> &values, const bool inverse, const NttPrime &prime) {
+    const std::size_t size = values.size();
+    const std::uint64_t modulus = prime.modulus;
+    if (size > NTT_MAX_SIZE) {
+        throw std::length_error("number-theoretic transforms are limited to 2^27 points");
+    }
+    for (std::size_t i = 1, j = 0; i < size; i++) {
+        std::size_t bit = size >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(values[i], values[j]);
+        }
+    }
+    for (std::size_t length = 2; length <= size; length <<= 1) {
+        std::uint64_t root = powMod(prime.root, (modulus-1)/length, modulus);
+        if (inverse) {
+            root = powMod(root, modulus-2, modulus);
+        }
+        for (std::size_t start = 0; start < size; start += length) {
+            std::uint64_t w = 1;
+            for (std::size_t i = 0; i < length/2; i++) {
+                const std::uint64_t u = values[start+i];
+                const std::uint64_t v = values[start+i+length/2]*w % modulus;
+                values[start+i] = static_cast<std::uint32_t>(u+v < modulus ? u+v : u+v-modulus);
+                values[start+i+length/2] = static_cast<std::uint32_t>(u >= v ? u-v : u+modulus-v);
+                w = w*root % modulus;
+            }
+        }
+    }
+    if (inverse) {
+        const std::uint64_t sizeInverse = powMod(size, modulus-2, modulus);
+        for (std::uint32_t &value : values) {
+            value = static_cast<std::uint32_t>(value*sizeInverse % modulus);
+        }
+    }
+}
+
+/**
+ * Squares a polynomial modulo a given prime using number-theoretic transforms
+ *
+ * @param poly The coefficients of the polynomial, lowest degree first
+ * @param prime The prime to square modulo
+ * @return The coefficients of poly^2
+ */
+std::vector<std::uint32_t> squarePolynomial(std::vector<std::uint32_t> poly, const NttPrime &prime) {
+    const std::size_t resultSize = poly.size()*2-1;
+    std::size_t size = 1;
+    while (size < resultSize) {
+        size <<= 1;
+    }
+    poly.resize(size);
+    ntt(poly,false,prime);
+    for (std::uint32_t &value : poly) {
+        value = static_cast<std::uint32_t>(static_cast<std::uint64_t>(value)*value % prime.modulus);
+    }
+    ntt(poly,true,prime);
+    poly.resize(resultSize);
+    return poly;
+}
+
+/**
+ * Combines residues modulo each of NTT_PRIMES into the single value below their product (Garner's algorithm)
+ *
+ * @param residues The value modulo each prime, in the same order as NTT_PRIMES
+ * @return The value modulo the product of NTT_PRIMES
+ */
+unsigned __int128 combineResidues(const std::array<std::uint32_t,NTT_PRIMES.size()> &residues) {
+    const std::uint64_t p0 = NTT_PRIMES[0].modulus, p1 = NTT_PRIMES[1].modulus, p2 = NTT_PRIMES[2].modulus;
+    const std::uint64_t k1 = (residues[1]+p1-residues[0]%p1)%p1*powMod(p0, p1-2, p1)%p1;
+    const std::uint64_t low = residues[0]+p0*k1;
+    const std::uint64_t k2 = (residues[2]+p2-low%p2)%p2*powMod(p0*p1%p2, p2-2, p2)%p2;
+    return low+static_cast<unsigned __int128>(p0*p1)*k2;
+}
+
+/**
+ * Digit kernels specialised at compile time for a base and for each digit length
+ *
+ * Every digit is extracted by a fully unrolled sequence with a constant divisor, which the compiler turns into
+ * multiplications, and there is no loop-ending branch whose outcome depends on the number. Since every number between
+ * consecutive powers of the base has the same length, a kernel is picked once per span rather than once per number
+ */
+template <std::uint64_t Base>
+class HnDigitKernels {
+public:
+    /**
+     * The most digits a 64-bit number can have in Base
+     */
+    static constexpr std::size_t MAX_DIGITS = [] {
+        std::size_t digits = 0;
+        for (std::uint64_t n = UINT64_MAX; n > 0; n /= Base) {
+            digits++;
+        }
+        return digits;
+    }();
+
+    /**
+     * A kernel which determines the happiness of every number in [from, to], all of which have the same length
+     */
+    using SpanKernel = void (*)(std::uint64_t from, std::uint64_t to, const std::uint8_t *table, std::vector<bool> &bitmap, std::uint64_t offset);
+    /**
+     * A kernel which determines if the digits of a number are in ascending order
+     */
+    using SortedKernel = bool (*)(std::uint64_t n);
+
+private:
+    template <std::size_t... Places>
+    static constexpr std::uint64_t sumOfDigitSquares(std::uint64_t n, std::index_sequence<Places...>) {
+        std::uint64_t sum = 0;
+        ((sum += (n%Base)*(n%Base), n /= Base, static_cast<void>(Places)), ...);
+        return sum;
+    }
+
+    template <std::size_t... Places>
+    static constexpr bool areDigitsSorted(std::uint64_t n, std::index_sequence<Places...>) {
+        std::uint64_t prevDigit = Base;
+        bool sorted = true;
+        // Combined with & rather than && so that no digit is skipped by a branch
+        ((sorted &= n%Base <= prevDigit, prevDigit = n%Base, n /= Base, static_cast<void>(Places)), ...);
+        return sorted;
+    }
+
+    template <std::size_t Digits>
+    static void happySpan(std::uint64_t from, const std::uint64_t to, const std::uint8_t *table, std::vector<bool> &bitmap, const std::uint64_t offset) {
+        for (std::uint64_t n = from; ; n++) {
+            bitmap[n-offset] = table[sumOfDigitSquares(n, std::make_index_sequence<Digits>())];
+            if (n == to) {
+                break;
+            }
+        }
+    }
+
+    template <std::size_t Digits>
+    static bool sorted(const std::uint64_t n) {
+        return areDigitsSorted(n, std::make_index_sequence<Digits>());
+    }
+
+    template <std::size_t... Lengths>
+    static constexpr std::array<SpanKernel, sizeof...(Lengths)> makeSpanKernels(std::index_sequence<Lengths...>) {
+        return {&happySpan<Lengths+1>...};
+    }
+
+    template <std::size_t... Lengths>
+    static constexpr std::array<SortedKernel, sizeof...(Lengths)> makeSortedKernels(std::index_sequence<Lengths...>) {
+        return {&sorted<Lengths+1>...};
+    }
+
+public:
+    /**
+     * Span kernels for each digit length, indexed by length-1
+     */
+    static constexpr std::array<SpanKernel, MAX_DIGITS> spanKernels = makeSpanKernels(std::make_index_sequence<MAX_DIGITS>());
+    /**
+     * Sorted kernels for each digit length, indexed by length-1
+     */
+    static constexpr std::array<SortedKernel, MAX_DIGITS> sortedKernels = makeSortedKernels(std::make_index_sequence<MAX_DIGITS>());
+
+    /**
+     * Determines the happiness of every number in [from, to], picking a kernel once for each digit length
+     *
+     * @param from The first number to calculate
+     * @param to The last number to calculate
+     * @param table The happiness of every sum of digit squares
+     * @param bitmap Where to store whether each number is happy, indexed from from
+     */
+    static void happyBitmap(const std::uint64_t &from, const std::uint64_t &to, const std::uint8_t *table, std::vector<bool> &bitmap) {
+        std::uint64_t spanStart = from;
+        std::size_t length = 1;
+        std::uint64_t spanEnd = Base-1;
+        while (spanEnd < spanStart) {
+            length++;
+            spanEnd = spanEnd > UINT64_MAX/Base ? UINT64_MAX : spanEnd*Base+Base-1;
+        }
+        while (true) {
+            spanKernels[length-1](spanStart, std::min(spanEnd, to), table, bitmap, from);
+            if (spanEnd >= to) {
+                break;
+            }
+            spanStart = spanEnd+1;
+            length++;
+            spanEnd = spanEnd > UINT64_MAX/Base ? UINT64_MAX : spanEnd*Base+Base-1;
+        }
+    }
+};
+
+/**
+ * Sizing derived from the resources actually available to this process
+ *
+ * Containers limit CPU and memory through cgroups, which std::thread::hardware_concurrency and the size of physical
+ * memory know nothing about, so using those directly leads to throttling and OOM kills. Both cgroup v2 and v1 are read
+ */
+class HnResources {
+public:
+    /**
+     * Roughly how much memory each entry of HnCalculator's cache uses, including the hash map's overhead
+     */
+    static constexpr std::uint64_t CACHE_ENTRY_BYTES = 48;
+
+    /**
+     * Gets how many threads can run at once without being throttled
+     *
+     * This is the fewest of the CPUs this process may be scheduled on (which reflects cpuset) and its CPU quota
+     *
+     * @return The default number of threads to use
+     */
+    static std::uint16_t threads() {
+        static const std::uint16_t threadCount = [] {
+            std::uint64_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+            cpu_set_t affinity;
+            if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+                cpus = std::min<std::uint64_t>(cpus, CPU_COUNT(&affinity));
+            }
+            std::uint64_t quota = 0;
+            std::uint64_t period = 0;
+            if (const std::optional<std::string> cpuMax = readCgroupFile("cpu.max", "cpu", "cpu.cfs_quota_us")) {
+                std::istringstream values(cpuMax.value());
+                std::string quotaText;
+                values >> quotaText >> period;
+                if (quotaText != "max" && quotaText[0] != '-') {
+                    quota = std::stoull(quotaText);
+                }
+                if (period == 0) {
+                    // cgroup v1 keeps the period in a separate file
+                    period = std::stoull(readCgroupFile("", "cpu", "cpu.cfs_period_us").value_or("100000"));
+                }
+            }
+            if (quota > 0 && period > 0) {
+                cpus = std::min(cpus, (quota+period-1)/period);
+            }
+            return static_cast<std::uint16_t>(std::max<std::uint64_t>(std::min<std::uint64_t>(cpus, UINT16_MAX), 1));
+        }();
+        return threadCount;
+    }
+
+    /**
+     * Gets how much memory this process may use before being killed
+     *
+     * @return The cgroup memory limit, or the size of physical memory if there is none
+     */
+    static std::uint64_t memoryLimit() {
+        static const std::uint64_t limit = [] {
+            std::uint64_t physical = static_cast<std::uint64_t>(sysconf(_SC_PHYS_PAGES))*sysconf(_SC_PAGESIZE);
+            const std::optional<std::string> memoryMax = readCgroupFile("memory.max", "memory", "memory.limit_in_bytes");
+            if (memoryMax && memoryMax.value() != "max") {
+                // cgroup v1 reports no limit as a value close to INT64_MAX, which this also ignores
+                physical = std::min<std::uint64_t>(physical, std::stoull(memoryMax.value()));
+            }
+            return physical;
+        }();
+        return limit;
+    }
+
+    /**
+     * Gets how many entries HnCalculator's cache may hold, being a quarter of the memory limit
+     */
+    static std::uint64_t cacheEntries() {
+        return memoryLimit()/4/CACHE_ENTRY_BYTES;
+    }
+
+    /**
+     * Gets the share of the last 10 seconds in which some task was stalled waiting for memory
+     *
+     * @return The memory pressure as a percentage, or nothing if the kernel does not report pressure stall information
+     */
+    static std::optional<double> memoryPressure() {
+        std::ifstream pressure("/proc/pressure/memory");
+        for (std::string word; pressure >> word;) {
+            if (word.rfind("avg10=", 0) == 0) {
+                return std::stod(word.substr(6));
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * Gets how much memory could be allocated without swapping
+     *
+     * @return MemAvailable in bytes, or nothing if it is not reported
+     */
+    static std::optional<std::uint64_t> memoryAvailable() {
+        std::ifstream meminfo("/proc/meminfo");
+        for (std::string key; meminfo >> key;) {
+            std::uint64_t kilobytes;
+            meminfo >> kilobytes;
+            if (key == "MemAvailable:") {
+                return kilobytes*1024;
+            }
+            meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        return std::nullopt;
+    }
+
+private:
+    /**
+     * Reads the first line of a file belonging to this process's cgroup
+     *
+     * @param v2File The name of the file under cgroup v2, or empty if there is no equivalent
+     * @param v1Controller The cgroup v1 controller the file belongs to
+     * @param v1File The name of the file under cgroup v1
+     * @return The first line of the file, or nothing if it could not be found
+     */
+    static std::optional<std::string> readCgroupFile(const std::string &v2File, const std::string &v1Controller, const std::string &v1File) {
+        std::vector<std::string> candidates;
+        std::ifstream cgroups("/proc/self/cgroup");
+        for (std::string line; std::getline(cgroups, line);) {
+            // Lines are hierarchy-ID:controller-list:path, and the v2 hierarchy has an empty controller list
+            const std::size_t first = line.find(':');
+            const std::size_t second = line.find(':', first+1);
+            if (first == std::string::npos || second == std::string::npos) {
+                continue;
+            }
+            const std::string controllers = ","+line.substr(first+1, second-first-1)+",";
+            const std::string path = line.substr(second+1);
+            if (controllers == ",," && !v2File.empty()) {
+                candidates.push_back("/sys/fs/cgroup"+path+"/"+v2File);
+                candidates.push_back("/sys/fs/cgroup/"+v2File);
+            } else if (controllers.find(","+v1Controller+",") != std::string::npos) {
+                // Inside a container the cgroup's own directory is usually mounted as the controller's root
+                candidates.push_back("/sys/fs/cgroup/"+v1Controller+path+"/"+v1File);
+                candidates.push_back("/sys/fs/cgroup/"+v1Controller+"/"+v1File);
+            }
+        }
+        for (const std::string &candidate : candidates) {
+            std::ifstream file(candidate);
+            std::string line;
+            if (std::getline(file, line) && !line.empty()) {
+                return line;
+            }
+        }
+        return std::nullopt;
+    }
+};
 
 class HnCalculator {
 public:
@@ -35,11 +459,46 @@ public:
      * How far apart milestones should be announced
      */
     std::optional<std::uint64_t> milestoneInc;
+    /**
+     * How many threads the digit DP should split its states across
+     */
+    std::uint16_t dpThreads = 1;
+    /**
+     * The most results which may be cached, which defaults to a quarter of the memory available to this process
+     *
+     * While memory is under pressure, a lower limit is applied on top of this without changing it
+     */
+    std::uint64_t cacheLimit = HnResources::cacheEntries();
+    /**
+     * The memory pressure percentage (see HnResources::memoryPressure) above which the cache is shrunk
+     */
+    double pressureThreshold = 10;
 
 private:
+    /**
+     * The lower limit on the cache applied while memory is under pressure, which grows back towards cacheLimit once
+     * the pressure clears
+     */
+    std::optional<std::uint64_t> pressureCacheLimit;
+    std::atomic<bool> stopPressureMonitor{false};
+    std::thread pressureMonitor;
     std::unordered_map<std::uint64_t,bool> cache;
     std::uint64_t nextNumber = 1;
     std::uint64_t lastMilestone = 0;
+    /**
+     * The base 10 sortedness kernel for the digit length of nextNumber, and the last number of that length
+     *
+     * These are only used when compiled with optimisation, since the kernels rely on the compiler unrolling them and
+     * replacing their divisions. Without it, as the default CMake build compiles, areDigitsSorted is quicker because it
+     * stops at the first unsorted digit
+     */
+#ifdef __OPTIMIZE__
+    static constexpr bool USE_SORTED_KERNELS = true;
+#else
+    static constexpr bool USE_SORTED_KERNELS = false;
+#endif
+    bool (*sortedKernel)(std::uint64_t) = nullptr;
+    std::uint64_t sortedKernelEnd = 0;
     std::mutex cacheLock;
     std::mutex nextNumberLock;
 
@@ -52,13 +511,23 @@ public:
         }
     }
 
+    HnCalculator(const HnCalculator&) = delete;
+    HnCalculator &operator=(const HnCalculator&) = delete;
+
+    ~HnCalculator() {
+        stopPressureMonitor = true;
+        if (pressureMonitor.joinable()) {
+            pressureMonitor.join();
+        }
+    }
+
     /**
      * Creates a given number of threads for calculating
      *
      * @param numThreads The number of threads to create
      * @param attachToLast Whether the calling thread should be used. If false (default), this will be a background task
      */
-    void startThreads(const std::uint16_t numThreads=1, const bool attachToLast=false) {
+    void startThreads(const std::uint16_t numThreads=HnResources::threads(), const bool attachToLast=false) {
         for (std::uint16_t i = 0; i < numThreads-attachToLast; i++) {
             std::thread(&HnCalculator::threadLoop, this).detach();
         }
@@ -67,6 +536,71 @@ public:
         }
     }
 
+    /**
+     * Creates a background thread which checks memory pressure at a given interval until stopAt is reached or the
+     * calculator is destroyed
+     *
+     * @param interval How long to wait between checks
+     */
+    void startPressureMonitor(const std::chrono::milliseconds interval=std::chrono::seconds(1)) {
+        if (pressureMonitor.joinable()) {
+            return;
+        }
+        pressureMonitor = std::thread([this, interval] {
+            while (!stopPressureMonitor) {
+                nextNumberLock.lock();
+                const bool finished = nextNumber >= stopAt;
+                nextNumberLock.unlock();
+                if (finished) {
+                    break;
+                }
+                adaptToMemoryPressure();
+                // Slept in short steps so that destroying the calculator does not wait for a whole interval
+                for (std::chrono::milliseconds slept{0}; slept < interval && !stopPressureMonitor; slept += std::chrono::milliseconds(100)) {
+                    std::this_thread::sleep_for(std::min<std::chrono::milliseconds>(interval-slept, std::chrono::milliseconds(100)));
+                }
+            }
+        });
+    }
+
+    /**
+     * Shrinks the cache if the system is short of memory, or grows it back towards cacheLimit if not
+     *
+     * Under pressure, the cache stops growing and loses half of its entries, and output is flushed so it is not held
+     * in buffers. Every adaptation is announced like milestones are
+     */
+    void adaptToMemoryPressure() {
+        const std::optional<double> pressure = HnResources::memoryPressure();
+        const std::optional<std::uint64_t> available = HnResources::memoryAvailable();
+        const bool underPressure = (pressure && pressure.value() > pressureThreshold)
+                || (available && available.value() < HnResources::memoryLimit()/10);
+        std::stringstream msg;
+        cacheLock.lock();
+        const std::uint64_t previousLimit = effectiveCacheLimit();
+        if (underPressure) {
+            pressureCacheLimit = std::min(previousLimit, static_cast<std::uint64_t>(cache.size()/2));
+            for (auto entry = cache.begin(); entry != cache.end() && cache.size() > pressureCacheLimit.value();) {
+                // 1 and 4 are kept because isHappy's recursion ends at them
+                entry = entry->first == 1 || entry->first == 4 ? std::next(entry) : cache.erase(entry);
+            }
+            std::cout.flush();
+            HN_PROBE(output_flush);
+        } else if (pressureCacheLimit) {
+            pressureCacheLimit = std::max<std::uint64_t>(pressureCacheLimit.value()*2, 1024);
+            if (pressureCacheLimit.value() >= cacheLimit) {
+                pressureCacheLimit.reset();
+            }
+        }
+        const std::uint64_t newLimit = effectiveCacheLimit();
+        if (newLimit != previousLimit) {
+            msg << "Memory pressure " << (underPressure ? "high" : "cleared") << ", cache limit " << previousLimit
+                << " -> " << newLimit << std::endl;
+            HN_PROBE(memory_pressure, underPressure, previousLimit, newLimit);
+        }
+        cacheLock.unlock();
+        std::cout << msg.str();
+    }
+
     /**
      * Determines if a given number is happy
      *
@@ -74,13 +608,16 @@ public:
      * @return Whether n is happy
      */
     bool isHappy(const std::uint64_t &n) { // NOLINT(*-no-recursion)
-        if (isCached(n)) {
-            return cache[n];
+        if (const std::optional<bool> cached = getCached(n)) {
+            return cached.value();
         } else if (n == 1) {
             return true;
         } else if (n == 4) {
             return false;
         }
+        if (cacheResults) {
+            HN_PROBE(cache_miss, n);
+        }
         std::uint64_t childNumber = sumOfDigitSquares(n);
         if (skipPermutations) {
             childNumber = sortDigits(childNumber);
@@ -90,55 +627,39 @@ public:
         return happy;
     }
 
-private:
-    /**
-     * Iteratively calculates whether numbers are happy until stopAt is reached
-     */
-    void threadLoop() {
-        std::uint64_t n = 0;
-        while (n < stopAt) {
-            isHappy(n = getNextNumber());
-        }
-    }
-
     /**
-     * Gets the next number needing calculated and announces milestones
+     * Determines if a given number is happy without using the cache or outputting results
      *
-     * This will skip permutations if skipPermutations is true
+     * Unlike isHappy, this detects cycles itself so it works for any base, not just those where 4 is in the only cycle
      *
-     * @return The next number to be calculated
+     * @param n The number which must be calculated
+     * @return Whether n is happy
      */
-    std::uint64_t getNextNumber() {
-        nextNumberLock.lock();
-        for (std::uint64_t i = nextNumber; true; i++) {
-            if (!skipPermutations || areDigitsSorted(i)) {
-                if (milestoneInc && i > lastMilestone+milestoneInc.value()) {
-                    lastMilestone += milestoneInc.value();
-                    std::stringstream msg;
-                    msg << lastMilestone << " numbers calculated" << std::endl;
-                    std::cout << msg.str();
-                }
-                nextNumber = i+1;
-                nextNumberLock.unlock();
-                return i;
-            }
-        }
+    bool computeHappy(const std::uint64_t &n) const {
+        std::uint64_t slow = n;
+        std::uint64_t fast = n;
+        do {
+            slow = sumOfDigitSquares(slow);
+            fast = sumOfDigitSquares(sumOfDigitSquares(fast));
+        } while (slow != fast);
+        return slow == 1;
     }
 
     /**
-     * Checks if a given number has been cached
+     * Calculates the height of a given number, being how many iterations it takes to reach 1
      *
-     * @param n The number for which the sum of digit squares must be calculated
-     * @return The sum of digit squares of n
+     * @param n The number which must be calculated
+     * @return The height of n, or nothing if n is not happy
      */
-    bool isCached(const std::uint64_t &n) {
-        if (!cacheResults) {
-            return false;
+    std::optional<std::uint16_t> height(std::uint64_t n) const {
+        if (!computeHappy(n)) {
+            return std::nullopt;
         }
-        cacheLock.lock();
-        const bool cached = cache.find(n) != cache.end();
-        cacheLock.unlock();
-        return cached;
+        std::uint16_t steps = 0;
+        for (; n != 1; steps++) {
+            n = sumOfDigitSquares(n);
+        }
+        return steps;
     }
 
     /**
@@ -156,26 +677,6 @@ private:
         return (n%base)*(n%base)+sumOfDigitSquares(n/base);
     }
 
-    /**
-     * Determines if the digits of a given number are in ascending order
-     *
-     * This is used for skipping permutations
-     *
-     * @param n The number for which the digits must be sorted
-     * @return Whether the digits are in ascending order
-     */
-    constexpr bool areDigitsSorted(std::uint64_t n) const {
-        char prevDigit = base;
-        while (n > 0) {
-            if (n%base > prevDigit) {
-                return false;
-            }
-            prevDigit = static_cast<char>(n % base);
-            n /= base;
-        }
-        return true;
-    }
-
     /**
      * Sort the digits of a given number in ascending order
      *
@@ -185,7 +686,7 @@ private:
      * @return the value of the sorted digits; cannot be more than n
      */
     std::uint64_t sortDigits(std::uint64_t n) const {
-        auto *digits = new char[base];
+        std::vector<char> digits(base, 0);
         while (n != 0) {
             if (n%base != 0) {
                 digits[n%base-1]++;
@@ -203,29 +704,4236 @@ private:
     }
 
     /**
-     * Handles a given new result
-     *
-     * Outputs the given result if outputResults
-     * Caches the given result if cacheResults
+     * Finds the first number in the cycle which a given number eventually enters
      *
-     * @param n The number for which a result has been determined
-     * @param happy The result- whether n was determined to be happy
+     * @param n The number which must be calculated
+     * @return 1 if n is happy, otherwise the first member of the unhappy cycle reached from n
      */
-    void newResult(const std::uint64_t &n, const bool &happy) {
-        if (outputResults) {
-            std::stringstream msg;
-            msg << n << " is" << (happy ? "" : " not") << " happy" << std::endl;
-            std::cout << msg.str();
-        }
-        if (cacheResults) {
-            cacheLock.lock();
-            cache.emplace(n,happy);
-            cacheLock.unlock();
+    std::uint64_t cycleEntry(const std::uint64_t &n) const {
+        std::uint64_t slow = n;
+        std::uint64_t fast = n;
+        do {
+            slow = sumOfDigitSquares(slow);
+            fast = sumOfDigitSquares(sumOfDigitSquares(fast));
+        } while (slow != fast);
+        // Floyd's algorithm: walking from the start and the meeting point in step, they meet at the cycle's entry
+        for (slow = n; slow != fast;) {
+            slow = sumOfDigitSquares(slow);
+            fast = sumOfDigitSquares(fast);
         }
+        return slow;
     }
-};
 
-/**
+    /**
+     * A run of repeated digits, so that numbers far too large to write out can be described by their structure
+     *
+     * e.g: base^k-1 is the single run {base-1, k} and a repunit is {1, k}
+     */
+    struct DigitRun {
+        char digit;
+        std::uint64_t count;
+    };
+
+    /**
+     * Determines if a number given as runs of digits is happy, without using the cache or outputting results
+     *
+     * The first sum of digit squares is simply the total of count*digit^2 over each run, so this takes no longer for
+     * a number with 10^12 digits than for one with 12
+     *
+     * @param runs The runs of digits making up the number, most significant first
+     * @return Whether the number is happy
+     */
+    bool isHappy(const std::vector<DigitRun> &runs) const {
+        return isOne(runs) || computeHappy(runSumOfDigitSquares(runs));
+    }
+
+    /**
+     * Calculates the height of a number given as runs of digits
+     *
+     * @param runs The runs of digits making up the number, most significant first
+     * @return The height of the number, or nothing if it is not happy
+     */
+    std::optional<std::uint16_t> height(const std::vector<DigitRun> &runs) const {
+        if (isOne(runs)) {
+            return 0;
+        }
+        const std::optional<std::uint16_t> childHeight = height(runSumOfDigitSquares(runs));
+        if (!childHeight) {
+            return std::nullopt;
+        }
+        return childHeight.value()+1;
+    }
+
+    /**
+     * Calculates how many sums of digit squares each value is produced by, over every string of the given number of digits
+     *
+     * This is the single-digit distribution convolved with itself digits times, calculated by exponentiation by squaring
+     * using number-theoretic transforms modulo a prime
+     *
+     * @param digits The number of digits (leading zeros included), for which digits*(base-1)^2 must be below 2^26
+     * @param prime The prime the counts are taken modulo
+     * @return How many numbers below base^digits have each sum of digit squares, modulo prime
+     */
+    std::vector<std::uint32_t> digitSquareSumDistribution(const std::uint64_t &digits, const NttPrime &prime=NTT_PRIMES[0]) const {
+        if (digits > (NTT_MAX_SIZE/2-1)/((base-1)*(base-1))) {
+            throw std::length_error("too many digits for the sum of digit squares distribution to be transformed");
+        }
+        std::vector<std::uint32_t> result = {1};
+        for (int bit = 63; bit >= 0; bit--) {
+            if (result.size() > 1) {
+                result = squarePolynomial(result, prime);
+            }
+            if ((digits >> bit) & 1) {
+                // Multiplying by the single-digit distribution only adds base terms, so it is cheaper done directly
+                std::vector<std::uint32_t> next(result.size()+(base-1)*(base-1), 0);
+                for (std::size_t s = 0; s < result.size(); s++) {
+                    for (char digit = 0; digit < base; digit++) {
+                        std::uint32_t &target = next[s+digit*digit];
+                        target = static_cast<std::uint32_t>((static_cast<std::uint64_t>(target)+result[s]) % prime.modulus);
+                    }
+                }
+                result = std::move(next);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Counts the happy numbers below base^digits
+     *
+     * This is fast enough for numbers of digits far beyond what can be iterated, since only the distribution of the
+     * first sum of digit squares needs to be known. The count is found modulo each of NTT_PRIMES and combined, so it is
+     * exact while base^digits is below their product (up to 28 digits in base 10, and up to 93 in base 2); for more
+     * digits it is the count modulo that product. Transforms limit digits*(base-1)^2 to below 2^26, which is about
+     * 828,000 digits in base 10, and more digits than that throw std::length_error
+     *
+     * @param digits The number of digits
+     * @return How many numbers in [1, base^digits) are happy, modulo the product of NTT_PRIMES
+     */
+    unsigned __int128 countHappyBelowPower(const std::uint64_t &digits) const {
+        std::array<std::uint32_t,NTT_PRIMES.size()> residues{};
+        for (std::size_t i = 0; i < NTT_PRIMES.size(); i++) {
+            const std::vector<std::uint32_t> distribution = digitSquareSumDistribution(digits, NTT_PRIMES[i]);
+            std::uint64_t count = 0;
+            // The sum is 0 only for 0 itself, which is not happy
+            for (std::uint64_t s = 1; s < distribution.size(); s++) {
+                if (distribution[s] != 0 && computeHappy(s)) {
+                    count = (count+distribution[s]) % NTT_PRIMES[i].modulus;
+                }
+            }
+            residues[i] = static_cast<std::uint32_t>(count);
+        }
+        return combineResidues(residues);
+    }
+
+    /**
+     * Determines whether countHappyBelowPower is exact for a given number of digits
+     *
+     * @param digits The number of digits
+     * @return Whether base^digits is below the product of NTT_PRIMES
+     */
+    bool isPowerCountExact(const std::uint64_t &digits) const {
+        long double power = 1;
+        for (std::uint64_t i = 0; i < digits && power < 1e30L; i++) {
+            power *= base;
+        }
+        return power < static_cast<long double>(NTT_PRIMES[0].modulus)*NTT_PRIMES[1].modulus*NTT_PRIMES[2].modulus;
+    }
+
+    /**
+     * Counts the happy numbers in [1, limit] which are congruent to residue modulo modulus
+     *
+     * @param limit The highest number which may be counted
+     * @param modulus The modulus of the arithmetic progression (defaults to 1, meaning every number)
+     * @param residue The residue of the arithmetic progression
+     * @return How many numbers in the progression up to limit are happy
+     */
+    std::uint64_t countHappy(const std::uint64_t &limit, const std::uint64_t &modulus=1, const std::uint64_t &residue=0) const {
+        return happyDigitDp(limit, modulus, residue).count;
+    }
+
+    /**
+     * Sums the happy numbers in [1, limit] which are congruent to residue modulo modulus
+     *
+     * @param limit The highest number which may be summed
+     * @param modulus The modulus of the arithmetic progression (defaults to 1, meaning every number)
+     * @param residue The residue of the arithmetic progression
+     * @return The sum of the numbers in the progression up to limit which are happy
+     */
+    unsigned __int128 sumHappy(const std::uint64_t &limit, const std::uint64_t &modulus=1, const std::uint64_t &residue=0) const {
+        return happyDigitDp(limit, modulus, residue).sum;
+    }
+
+    /**
+     * Finds the nth happy number which is congruent to residue modulo modulus
+     *
+     * @param index Which happy number to find, starting from 1
+     * @param modulus The modulus of the arithmetic progression (defaults to 1, meaning every number)
+     * @param residue The residue of the arithmetic progression
+     * @return The nth happy number in the progression, or nothing if it does not fit in 64 bits
+     */
+    std::optional<std::uint64_t> nthHappy(const std::uint64_t &index, const std::uint64_t &modulus=1, const std::uint64_t &residue=0) const {
+        if (index == 0 || countHappy(UINT64_MAX, modulus, residue) < index) {
+            return std::nullopt;
+        }
+        std::uint64_t low = 1;
+        std::uint64_t high = UINT64_MAX;
+        while (low < high) {
+            const std::uint64_t mid = low+(high-low)/2;
+            if (countHappy(mid, modulus, residue) >= index) {
+                high = mid;
+            } else {
+                low = mid+1;
+            }
+        }
+        return low;
+    }
+
+    /**
+     * Counts the happy numbers in each of many inclusive intervals at once
+     *
+     * A table of how many digit suffixes of each length complete each sum of digit squares to a happy one is built
+     * once, so each bound then takes a single walk over its digits. Bounds are also sorted so that each one only
+     * walks the digits after those it shares with the previous bound
+     *
+     * @param intervals The [from, to] intervals to count
+     * @return How many happy numbers each interval contains, in the same order
+     */
+    std::vector<std::uint64_t> countHappyBatch(const std::vector<std::pair<std::uint64_t,std::uint64_t>> &intervals) const {
+        std::vector<std::uint64_t> bounds;
+        for (const std::pair<std::uint64_t,std::uint64_t> &interval : intervals) {
+            bounds.push_back(interval.second);
+            if (interval.first > 0) {
+                bounds.push_back(interval.first-1);
+            }
+        }
+        std::sort(bounds.begin(), bounds.end());
+        bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+        std::uint64_t digits = 0;
+        for (std::uint64_t n = UINT64_MAX; n > 0; n /= base) {
+            digits++;
+        }
+        const std::uint64_t maxSum = maxDigitSquareSum();
+        // completions[length*(maxSum+1)+s] is how many strings of length digits take a sum of s to a happy sum
+        std::vector<std::uint64_t> completions((digits+1)*(maxSum+1), 0);
+        for (std::uint64_t s = 0; s <= maxSum; s++) {
+            completions[s] = computeHappy(s);
+        }
+        for (std::uint64_t length = 1; length <= digits; length++) {
+            for (std::uint64_t s = 0; s <= maxSum; s++) {
+                for (char digit = 0; digit < base && s+digit*digit <= maxSum; digit++) {
+                    completions[length*(maxSum+1)+s] += completions[(length-1)*(maxSum+1)+s+digit*digit];
+                }
+            }
+        }
+        // How many happy numbers below each prefix of the previous bound, and that prefix's sum of digit squares
+        std::vector<std::uint64_t> countBefore(digits+1, 0);
+        std::vector<std::uint64_t> prefixSum(digits+1, 0);
+        std::vector<char> previousDigits(digits, 0);
+        std::vector<std::uint64_t> boundCounts(bounds.size());
+        for (std::size_t i = 0; i < bounds.size(); i++) {
+            std::vector<char> boundDigits(digits);
+            std::uint64_t n = bounds[i];
+            for (std::uint64_t position = digits; position > 0; position--, n /= base) {
+                boundDigits[position-1] = static_cast<char>(n%base);
+            }
+            std::uint64_t shared = 0;
+            while (i > 0 && shared < digits && boundDigits[shared] == previousDigits[shared]) {
+                shared++;
+            }
+            for (std::uint64_t position = shared; position < digits; position++) {
+                std::uint64_t count = countBefore[position];
+                for (char digit = 0; digit < boundDigits[position]; digit++) {
+                    count += completions[(digits-position-1)*(maxSum+1)+prefixSum[position]+digit*digit];
+                }
+                countBefore[position+1] = count;
+                prefixSum[position+1] = prefixSum[position]+boundDigits[position]*boundDigits[position];
+            }
+            // The bound itself is counted as well, as it is an inclusive limit
+            boundCounts[i] = countBefore[digits]+computeHappy(prefixSum[digits]);
+            previousDigits = boundDigits;
+        }
+        std::vector<std::uint64_t> counts;
+        for (const std::pair<std::uint64_t,std::uint64_t> &interval : intervals) {
+            const auto countUpTo = [&](const std::uint64_t &bound) {
+                return boundCounts[std::lower_bound(bounds.begin(), bounds.end(), bound)-bounds.begin()];
+            };
+            counts.push_back(interval.first > interval.second ? 0
+                    : countUpTo(interval.second)-(interval.first > 0 ? countUpTo(interval.first-1) : 0));
+        }
+        return counts;
+    }
+
+    /**
+     * Calculates the happiness of every number in a range
+     *
+     * Every number's first sum of digit squares is looked up in a table of the happiness of every possible sum, so no
+     * number needs more than a single iteration. The table is shared with every other calculator for the same base
+     *
+     * @param from The first number to calculate
+     * @param to The last number to calculate
+     * @return Whether each number in [from, to] is happy, indexed from from
+     */
+    std::vector<bool> happyBitmap(const std::uint64_t &from, const std::uint64_t &to) const;
+
+    /**
+     * Calculates the happiness of every number in a range using a prebuilt happiness table
+     *
+     * @param from The first number to calculate
+     * @param to The last number to calculate
+     * @param table The happiness of every sum of digit squares, as produced by happinessTable
+     * @return Whether each number in [from, to] is happy, indexed from from
+     */
+    std::vector<bool> happyBitmap(const std::uint64_t &from, const std::uint64_t &to, const std::uint8_t *table) const {
+        std::vector<bool> bitmap(to-from+1);
+        HN_PROBE(chunk_start, from, to);
+        switch (base) {
+            case 2: HnDigitKernels<2>::happyBitmap(from, to, table, bitmap); break;
+            case 8: HnDigitKernels<8>::happyBitmap(from, to, table, bitmap); break;
+            case 10: HnDigitKernels<10>::happyBitmap(from, to, table, bitmap); break;
+            case 16: HnDigitKernels<16>::happyBitmap(from, to, table, bitmap); break;
+            default:
+                for (std::uint64_t n = from; ; n++) {
+                    bitmap[n-from] = table[sumOfDigitSquares(n)];
+                    if (n == to) {
+                        break;
+                    }
+                }
+        }
+        HN_PROBE(chunk_end, from, to);
+        return bitmap;
+    }
+
+    /**
+     * Calculates the highest sum of digit squares of any 64-bit number
+     */
+    std::uint64_t maxDigitSquareSum() const {
+        std::uint64_t digits = 0;
+        for (std::uint64_t n = UINT64_MAX; n > 0; n /= base) {
+            digits++;
+        }
+        return digits*(base-1)*(base-1);
+    }
+
+    /**
+     * Calculates the happiness of every value which can be the sum of digit squares of a 64-bit number
+     *
+     * @return 1 for each sum of digit squares which is happy, otherwise 0
+     */
+    std::vector<std::uint8_t> happinessTable() const {
+        std::vector<std::uint8_t> table(maxDigitSquareSum()+1);
+        for (std::uint64_t s = 0; s < table.size(); s++) {
+            table[s] = computeHappy(s);
+        }
+        return table;
+    }
+
+    /**
+     * Calculates the height of every value which can be the sum of digit squares of a 64-bit number
+     *
+     * @return The height of each sum of digit squares, or UINT8_MAX for those which are not happy
+     */
+    std::vector<std::uint8_t> heightTable() const {
+        std::vector<std::uint8_t> table(maxDigitSquareSum()+1);
+        for (std::uint64_t s = 0; s < table.size(); s++) {
+            table[s] = static_cast<std::uint8_t>(height(s).value_or(UINT8_MAX));
+        }
+        return table;
+    }
+
+    /**
+     * Calculates the sum of digit squares of every number with at most digitChunkLength() digits
+     *
+     * This allows sums of digit squares to be calculated a chunk of digits at a time
+     *
+     * @return The sum of digit squares of each number below base^digitChunkLength(), as 16-bit values
+     */
+    std::vector<std::uint16_t> digitChunkTable() const {
+        std::uint64_t size = 1;
+        for (std::uint64_t i = 0; i < digitChunkLength(); i++) {
+            size *= base;
+        }
+        std::vector<std::uint16_t> table(size);
+        for (std::uint64_t n = 0; n < size; n++) {
+            table[n] = static_cast<std::uint16_t>(sumOfDigitSquares(n));
+        }
+        return table;
+    }
+
+    /**
+     * Calculates how many digits each entry of digitChunkTable covers, being as many as fit in 2^16 entries
+     */
+    std::uint64_t digitChunkLength() const {
+        std::uint64_t length = 0;
+        for (std::uint64_t size = base; size <= 1 << 16; size *= base) {
+            length++;
+        }
+        return length;
+    }
+
+    /**
+     * Counts how many windows of a given number of consecutive digits in a file are happy
+     *
+     * @param path A file of digits (0-9 then a-z); any other characters, such as whitespace or a decimal point, are
+     *             skipped
+     * @param windowLength How many digits each window contains
+     * @return How many windows are happy
+     */
+    std::uint64_t windowHappyCount(const std::string &path, const std::uint64_t &windowLength) const {
+        std::uint64_t count = 0;
+        scanWindows(path, windowLength, [&count](const bool happy) {
+            count += happy;
+        });
+        return count;
+    }
+
+    /**
+     * Determines the happiness of every window of a given number of consecutive digits in a file
+     *
+     * @param path A file of digits (0-9 then a-z); any other characters, such as whitespace or a decimal point, are
+     *             skipped
+     * @param windowLength How many digits each window contains
+     * @return Whether each window is happy, indexed by the position of its first digit among the digits of the file
+     */
+    std::vector<bool> windowHappyBitmap(const std::string &path, const std::uint64_t &windowLength) const {
+        std::vector<bool> bitmap;
+        scanWindows(path, windowLength, [&bitmap](const bool happy) {
+            bitmap.push_back(happy);
+        });
+        return bitmap;
+    }
+
+private:
+    /**
+     * Slides a window of digits along a file, reporting the happiness of each window in order
+     *
+     * The file is memory mapped and the window's sum of digit squares is updated by adding the square of the incoming
+     * digit and subtracting that of the outgoing one, so each step is constant time however long the window is
+     *
+     * @param path The file of digits
+     * @param windowLength How many digits each window contains
+     * @param onWindow Called with the happiness of each window
+     */
+    template <typename Callback>
+    void scanWindows(const std::string &path, const std::uint64_t &windowLength, Callback onWindow) const {
+        if (windowLength == 0) {
+            throw std::invalid_argument("windows must contain at least one digit");
+        }
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("could not open digit stream "+path);
+        }
+        struct stat info{};
+        if (fstat(fd, &info) == -1 || info.st_size == 0) {
+            close(fd);
+            return;
+        }
+        const std::size_t size = info.st_size;
+        void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("could not map digit stream "+path);
+        }
+        madvise(address, size, MADV_SEQUENTIAL);
+        const auto *stream = static_cast<const unsigned char*>(address);
+        // Squares of each character's digit value, or -1 for characters which are not digits in this base
+        std::int16_t squares[256];
+        for (int c = 0; c < 256; c++) {
+            const int value = c >= '0' && c <= '9' ? c-'0' : c >= 'a' && c <= 'z' ? c-'a'+10 : base;
+            squares[c] = static_cast<std::int16_t>(value < base ? value*value : -1);
+        }
+        // A window never holds more digits than the file has bytes, and a sum above the largest sum of digit squares of
+        // a 64-bit number is taken one step further before being looked up, so the table stays small however long the
+        // window is
+        const std::uint64_t largestSum = std::min(std::min<std::uint64_t>(windowLength, size)*(base-1)*(base-1), maxDigitSquareSum());
+        std::vector<std::uint8_t> table(largestSum+1);
+        for (std::uint64_t s = 0; s < table.size(); s++) {
+            table[s] = computeHappy(s);
+        }
+        std::uint64_t sum = 0;
+        std::uint64_t digitsInWindow = 0;
+        std::size_t outgoing = 0;
+        for (std::size_t incoming = 0; incoming < size; incoming++) {
+            if (squares[stream[incoming]] < 0) {
+                continue;
+            }
+            sum += squares[stream[incoming]];
+            if (digitsInWindow < windowLength) {
+                digitsInWindow++;
+            } else {
+                while (squares[stream[outgoing]] < 0) {
+                    outgoing++;
+                }
+                sum -= squares[stream[outgoing++]];
+            }
+            if (digitsInWindow == windowLength) {
+                onWindow(table[sum < table.size() ? sum : sumOfDigitSquares(sum)] != 0);
+            }
+        }
+        munmap(address, size);
+    }
+
+    /**
+     * Calculates the sum of the squares of the digits of a number given as runs of digits
+     *
+     * @param runs The runs of digits making up the number
+     * @return The sum of digit squares of the number
+     */
+    std::uint64_t runSumOfDigitSquares(const std::vector<DigitRun> &runs) const {
+        std::uint64_t sum = 0;
+        for (const DigitRun &run : runs) {
+            if (run.digit < 0 || run.digit >= base) {
+                throw std::invalid_argument("digit is not valid in this base");
+            }
+            std::uint64_t runSum;
+            if (__builtin_mul_overflow(run.count, static_cast<std::uint64_t>(run.digit*run.digit), &runSum)
+                    || __builtin_add_overflow(sum, runSum, &sum)) {
+                throw std::overflow_error("sum of digit squares does not fit in 64 bits");
+            }
+        }
+        return sum;
+    }
+
+    /**
+     * Determines if a number given as runs of digits is 1, which is the only number whose height is 0
+     */
+    static bool isOne(const std::vector<DigitRun> &runs) {
+        bool seenOne = false;
+        for (const DigitRun &run : runs) {
+            if (run.count == 0 || (run.digit == 0 && !seenOne)) {
+                continue;
+            } else if (run.digit != 1 || run.count != 1 || seenOne) {
+                return false;
+            }
+            seenOne = true;
+        }
+        return seenOne;
+    }
+
+    /**
+     * Totals of the numbers found by the digit DP
+     */
+    struct DpTotals {
+        std::uint64_t count = 0;
+        unsigned __int128 sum = 0;
+    };
+
+    /**
+     * Counts and sums the happy numbers in [1, limit] which are congruent to residue modulo modulus
+     *
+     * Digits of limit are walked from most significant, keeping how many numbers below the limit's prefix reach each
+     * (sum of digit squares, residue) state. Since the sum of digit squares is at most a few thousand, this takes
+     * milliseconds regardless of limit
+     *
+     * @param limit The highest number which may be counted
+     * @param modulus The modulus of the arithmetic progression
+     * @param residue The residue of the arithmetic progression
+     * @return The count and sum of the matching happy numbers
+     */
+    DpTotals happyDigitDp(const std::uint64_t &limit, const std::uint64_t &modulus, const std::uint64_t &residue) const {
+        if (modulus == 0) {
+            throw std::invalid_argument("modulus must be positive");
+        }
+        std::vector<char> limitDigits;
+        for (std::uint64_t n = limit; n > 0; n /= base) {
+            limitDigits.insert(limitDigits.begin(), static_cast<char>(n%base));
+        }
+        const std::uint64_t maxSum = limitDigits.size()*(base-1)*(base-1);
+        const std::uint64_t states = (maxSum+1)*modulus;
+        std::vector<std::uint64_t> counts(states, 0);
+        std::vector<unsigned __int128> sums(states, 0);
+        // Where appending each digit moves each residue, laid out by digit then residue
+        std::vector<std::uint64_t> residueTargets(base*modulus);
+        for (char digit = 0; digit < base; digit++) {
+            for (std::uint64_t r = 0; r < modulus; r++) {
+                residueTargets[digit*modulus+r] = (r*base+digit)%modulus;
+            }
+        }
+        std::uint64_t tightSum = 0;
+        std::uint64_t tightResidue = 0;
+        std::uint64_t tightValue = 0;
+        for (const char &limitDigit : limitDigits) {
+            std::vector<std::uint64_t> nextCounts(states, 0);
+            std::vector<unsigned __int128> nextSums(states, 0);
+            if (dpThreads <= 1) {
+                dpTransition(counts, sums, nextCounts, nextSums, residueTargets, modulus, 0, maxSum+1);
+            } else {
+                // Each thread owns a range of destination sums, so no two threads ever write the same state
+                std::vector<std::thread> threads;
+                const std::uint64_t rangeSize = (maxSum+dpThreads)/dpThreads;
+                for (std::uint64_t from = 0; from <= maxSum; from += rangeSize) {
+                    threads.emplace_back(&HnCalculator::dpTransition, this, std::cref(counts), std::cref(sums),
+                                         std::ref(nextCounts), std::ref(nextSums), std::cref(residueTargets), modulus,
+                                         from, std::min(from+rangeSize, maxSum+1));
+                }
+                for (std::thread &thread : threads) {
+                    thread.join();
+                }
+            }
+            // Numbers which match the limit so far can only continue below it from here
+            for (char digit = 0; digit < limitDigit; digit++) {
+                const std::uint64_t next = (tightSum+digit*digit)*modulus+(tightResidue*base+digit)%modulus;
+                nextCounts[next]++;
+                nextSums[next] += tightValue*base+digit;
+            }
+            tightSum += limitDigit*limitDigit;
+            tightResidue = (tightResidue*base+limitDigit)%modulus;
+            tightValue = tightValue*base+limitDigit;
+            counts = std::move(nextCounts);
+            sums = std::move(nextSums);
+        }
+        if (!limitDigits.empty()) {
+            counts[tightSum*modulus+tightResidue]++;
+            sums[tightSum*modulus+tightResidue] += tightValue;
+        }
+        DpTotals totals;
+        // The sum is 0 only for 0 itself, which is not happy
+        for (std::uint64_t s = 1; s <= maxSum; s++) {
+            if (computeHappy(s)) {
+                totals.count += counts[s*modulus+residue%modulus];
+                totals.sum += sums[s*modulus+residue%modulus];
+            }
+        }
+        return totals;
+    }
+
+    /**
+     * Appends every digit to the DP states whose new sum of digit squares is in [fromSum, toSum)
+     *
+     * Digits are the outer loop so that each one is a plain shift-and-add over contiguous rows of states, which the
+     * compiler can vectorize (entirely so when modulus is 1)
+     *
+     * @param counts How many numbers reach each state before appending a digit
+     * @param sums The sum of the numbers reaching each state before appending a digit
+     * @param nextCounts Where to add how many numbers reach each state after appending a digit
+     * @param nextSums Where to add the sum of the numbers reaching each state after appending a digit
+     * @param residueTargets The residue each residue moves to for each appended digit
+     * @param modulus The modulus of the arithmetic progression
+     * @param fromSum The lowest destination sum of digit squares to calculate
+     * @param toSum One past the highest destination sum of digit squares to calculate
+     */
+    void dpTransition(const std::vector<std::uint64_t> &counts, const std::vector<unsigned __int128> &sums,
+                      std::vector<std::uint64_t> &nextCounts, std::vector<unsigned __int128> &nextSums,
+                      const std::vector<std::uint64_t> &residueTargets, const std::uint64_t modulus,
+                      const std::uint64_t fromSum, const std::uint64_t toSum) const {
+        for (char digit = 0; digit < base; digit++) {
+            const std::uint64_t shift = digit*digit;
+            if (modulus == 1) {
+                for (std::uint64_t s = std::max(fromSum, shift); s < toSum; s++) {
+                    nextCounts[s] += counts[s-shift];
+                    nextSums[s] += sums[s-shift]*base+static_cast<unsigned __int128>(digit)*counts[s-shift];
+                }
+                continue;
+            }
+            const std::uint64_t *targets = &residueTargets[digit*modulus];
+            for (std::uint64_t s = std::max(fromSum, shift); s < toSum; s++) {
+                const std::uint64_t *sourceCounts = &counts[(s-shift)*modulus];
+                const unsigned __int128 *sourceSums = &sums[(s-shift)*modulus];
+                std::uint64_t *targetCounts = &nextCounts[s*modulus];
+                unsigned __int128 *targetSums = &nextSums[s*modulus];
+                for (std::uint64_t r = 0; r < modulus; r++) {
+                    targetCounts[targets[r]] += sourceCounts[r];
+                    targetSums[targets[r]] += sourceSums[r]*base+static_cast<unsigned __int128>(digit)*sourceCounts[r];
+                }
+            }
+        }
+    }
+
+    /**
+     * Iteratively calculates whether numbers are happy until stopAt is reached
+     */
+    void threadLoop() {
+        std::uint64_t n = 0;
+        while (n < stopAt) {
+            isHappy(n = getNextNumber());
+        }
+    }
+
+    /**
+     * Gets the next number needing calculated and announces milestones
+     *
+     * This will skip permutations if skipPermutations is true
+     *
+     * @return The next number to be calculated
+     */
+    std::uint64_t getNextNumber() {
+        nextNumberLock.lock();
+        for (std::uint64_t i = nextNumber; true; i++) {
+            // Every number up to the next power of the base has the same length, so the kernel is only picked again
+            // once the numbers reach a new length
+            if (USE_SORTED_KERNELS && skipPermutations && base == 10 && (sortedKernel == nullptr || i > sortedKernelEnd)) {
+                std::size_t length = 1;
+                for (sortedKernelEnd = 9; sortedKernelEnd < i; length++) {
+                    sortedKernelEnd = sortedKernelEnd > UINT64_MAX/10 ? UINT64_MAX : sortedKernelEnd*10+9;
+                }
+                sortedKernel = HnDigitKernels<10>::sortedKernels[length-1];
+            }
+            if (!skipPermutations || (sortedKernel ? sortedKernel(i) : areDigitsSorted(i))) {
+                if (milestoneInc && i > lastMilestone+milestoneInc.value()) {
+                    lastMilestone += milestoneInc.value();
+                    std::stringstream msg;
+                    msg << lastMilestone << " numbers calculated" << std::endl;
+                    std::cout << msg.str();
+                    HN_PROBE(milestone, lastMilestone);
+                }
+                nextNumber = i+1;
+                nextNumberLock.unlock();
+                return i;
+            }
+        }
+    }
+
+    /**
+     * Gets the most results which may currently be cached, being cacheLimit or the lower limit applied under memory
+     * pressure
+     *
+     * This must be called with cacheLock held
+     */
+    std::uint64_t effectiveCacheLimit() const {
+        return pressureCacheLimit ? std::min(cacheLimit, pressureCacheLimit.value()) : cacheLimit;
+    }
+
+    /**
+     * Gets the cached result for a given number
+     *
+     * The lookup is done under the lock since adaptToMemoryPressure may evict entries at any time
+     *
+     * @param n The number for which the cached result must be found
+     * @return Whether n is happy, or nothing if n has not been cached
+     */
+    std::optional<bool> getCached(const std::uint64_t &n) {
+        if (!cacheResults) {
+            return std::nullopt;
+        }
+        cacheLock.lock();
+        const auto entry = cache.find(n);
+        const std::optional<bool> cached = entry == cache.end() ? std::nullopt : std::optional<bool>(entry->second);
+        cacheLock.unlock();
+        return cached;
+    }
+
+    /**
+     * Determines if the digits of a given number are in ascending order
+     *
+     * This is used for skipping permutations
+     *
+     * @param n The number for which the digits must be sorted
+     * @return Whether the digits are in ascending order
+     */
+    constexpr bool areDigitsSorted(std::uint64_t n) const {
+        char prevDigit = base;
+        while (n > 0) {
+            if (n%base > prevDigit) {
+                return false;
+            }
+            prevDigit = static_cast<char>(n % base);
+            n /= base;
+        }
+        return true;
+    }
+
+    /**
+     * Handles a given new result
+     *
+     * Outputs the given result if outputResults
+     * Caches the given result if cacheResults and the cache has not reached cacheLimit
+     *
+     * @param n The number for which a result has been determined
+     * @param happy The result- whether n was determined to be happy
+     */
+    void newResult(const std::uint64_t &n, const bool &happy) {
+        if (outputResults) {
+            std::stringstream msg;
+            msg << n << " is" << (happy ? "" : " not") << " happy" << std::endl;
+            const std::string line = msg.str();
+            std::cout << line;
+            HN_PROBE(output_write, n, line.size());
+        }
+        if (cacheResults) {
+            cacheLock.lock();
+            if (cache.size() < effectiveCacheLimit()) {
+                cache.emplace(n,happy);
+                HN_PROBE(cache_insert, n, happy);
+            }
+            cacheLock.unlock();
+        }
+    }
+};
+
+
+/**
+ * A query for the numbers in a range which satisfy every one of a combination of predicates
+ *
+ * The most selective predicate which can generate its own candidates is used to enumerate them, and the candidates are
+ * streamed through the remaining predicates cheapest and most selective first
+ */
+class HnQuery {
+public:
+    /**
+     * The kinds of predicate a query can combine
+     */
+    enum class Predicate {
+        Happy,
+        Prime,
+        Palindrome,
+        Residue,
+        DigitPattern,
+        Height
+    };
+
+private:
+    /**
+     * A predicate along with its arguments
+     */
+    struct Condition {
+        Predicate predicate;
+        std::uint64_t a = 0;
+        std::uint64_t b = 0;
+        std::string pattern;
+    };
+
+    /**
+     * Calls a function with each candidate a generator produces
+     */
+    using Visitor = std::function<void(std::uint64_t)>;
+
+    /**
+     * Enumerates candidates in ascending order over a space of indices, so that index ranges can be split across threads
+     */
+    struct Generator {
+        std::string name;
+        /**
+         * How many indices there are
+         */
+        std::uint64_t size = 0;
+        /**
+         * How many candidates are produced over every index, which is only estimated by generators that skip indices
+         */
+        double candidates = 0;
+        /**
+         * Produces the candidates of the indices in [begin, end) in ascending order
+         */
+        std::function<void(std::uint64_t,std::uint64_t,const Visitor&)> forEach;
+        /**
+         * The condition which the generator already guarantees, if any
+         */
+        std::optional<std::size_t> satisfies;
+    };
+
+    /**
+     * How many numbers the prime generator sieves at a time
+     */
+    static constexpr std::uint64_t SIEVE_SEGMENT = 1 << 18;
+    /**
+     * The highest number the prime generator can sieve up to, beyond which sieving primes up to its square root costs
+     * more than testing candidates with Miller-Rabin
+     */
+    static constexpr std::uint64_t MAX_SIEVED = 1ULL << 52;
+
+    const HnCalculator &calculator;
+    std::vector<Condition> conditions;
+
+public:
+    explicit HnQuery(const HnCalculator &calculator) : calculator(calculator) {}
+
+    /**
+     * Requires numbers to be happy
+     */
+    HnQuery &happy() {
+        conditions.push_back({Predicate::Happy, 0, 0, ""});
+        return *this;
+    }
+
+    /**
+     * Requires numbers to be prime
+     */
+    HnQuery &prime() {
+        conditions.push_back({Predicate::Prime, 0, 0, ""});
+        return *this;
+    }
+
+    /**
+     * Requires the digits of numbers to be palindromic
+     */
+    HnQuery &palindrome() {
+        conditions.push_back({Predicate::Palindrome, 0, 0, ""});
+        return *this;
+    }
+
+    /**
+     * Requires numbers to be congruent to residue modulo modulus
+     *
+     * @param modulus The modulus of the arithmetic progression
+     * @param residue The residue of the arithmetic progression
+     */
+    HnQuery &residue(const std::uint64_t &modulus, const std::uint64_t &residue) {
+        if (modulus == 0) {
+            throw std::invalid_argument("modulus must be positive");
+        }
+        conditions.push_back({Predicate::Residue, modulus, residue%modulus, ""});
+        return *this;
+    }
+
+    /**
+     * Requires the digits of numbers, padded with leading zeros to the pattern's length, to match a pattern
+     *
+     * @param pattern One character per digit, being the digit itself (0-9 then a-z) or '?' to match any digit
+     */
+    HnQuery &digitPattern(const std::string &pattern) {
+        for (const char &c : pattern) {
+            if (c != '?' && digitValue(c) >= calculator.base) {
+                throw std::invalid_argument("pattern contains a character which is not a digit in this base");
+            }
+        }
+        conditions.push_back({Predicate::DigitPattern, 0, 0, pattern});
+        return *this;
+    }
+
+    /**
+     * Requires numbers to be happy with a given height
+     *
+     * @param h How many iterations numbers must take to reach 1
+     */
+    HnQuery &height(const std::uint16_t &h) {
+        conditions.push_back({Predicate::Height, h, 0, ""});
+        return *this;
+    }
+
+    /**
+     * Describes how the query would be run over a given range
+     *
+     * @param from The lowest number which may match
+     * @param to The highest number which may match
+     * @return The chosen generator followed by the filters in the order they would be applied
+     */
+    std::string explain(const std::uint64_t &from, const std::uint64_t &to) const {
+        const Generator generator = chooseGenerator(from, to);
+        std::stringstream msg;
+        // Candidates are only counted up to 2^64-1, since a range covering every 64-bit number has one more than that
+        const std::uint64_t candidates = generator.candidates >= 0x1p64 ? UINT64_MAX : static_cast<std::uint64_t>(generator.candidates);
+        msg << "generate " << generator.name << " (" << candidates << " candidates)";
+        for (const std::size_t &i : orderFilters(from, to, generator)) {
+            msg << " -> filter " << predicateName(conditions[i].predicate);
+        }
+        return msg.str();
+    }
+
+    /**
+     * Finds every number in a range which satisfies the query
+     *
+     * @param from The lowest number which may match
+     * @param to The highest number which may match
+     * @param numThreads The number of threads to filter candidates with
+     * @return The matching numbers in ascending order
+     */
+    std::vector<std::uint64_t> run(const std::uint64_t &from, const std::uint64_t &to, const std::uint16_t numThreads=HnResources::threads()) const {
+        const Generator generator = chooseGenerator(from, to);
+        const std::vector<std::size_t> filters = orderFilters(from, to, generator);
+        std::vector<std::vector<std::uint64_t>> results(std::max<std::uint16_t>(numThreads, 1));
+        const std::uint64_t sliceSize = generator.size/results.size()+1;
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < results.size(); t++) {
+            threads.emplace_back([&, t] {
+                // The slices may overshoot the size by up to one index each, which can pass 2^64 for the largest sizes
+                const std::uint64_t begin = static_cast<std::uint64_t>(std::min<unsigned __int128>(generator.size, static_cast<unsigned __int128>(t)*sliceSize));
+                const std::uint64_t end = static_cast<std::uint64_t>(std::min<unsigned __int128>(generator.size, static_cast<unsigned __int128>(t+1)*sliceSize));
+                // These are indices into the generator rather than numbers, so they are not chunk_start and chunk_end
+                HN_PROBE(query_slice_start, begin, end);
+                generator.forEach(begin, end, [&](const std::uint64_t n) {
+                    if (n < from || n > to) {
+                        return;
+                    }
+                    for (const std::size_t &filter : filters) {
+                        if (!test(conditions[filter], n)) {
+                            return;
+                        }
+                    }
+                    results[t].push_back(n);
+                });
+                HN_PROBE(query_slice_end, begin, end);
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        std::vector<std::uint64_t> matches;
+        for (const std::vector<std::uint64_t> &result : results) {
+            matches.insert(matches.end(), result.begin(), result.end());
+        }
+        return matches;
+    }
+
+private:
+    /**
+     * Gets the value of a digit character
+     *
+     * @param c 0-9 then a-z
+     * @return The value of c, or a value no base can have if c is not a digit
+     */
+    static char digitValue(const char &c) {
+        if (c >= '0' && c <= '9') {
+            return static_cast<char>(c-'0');
+        } else if (c >= 'a' && c <= 'z') {
+            return static_cast<char>(c-'a'+10);
+        }
+        return CHAR_MAX;
+    }
+
+    /**
+     * Gets a human-readable name for a predicate
+     */
+    static const char *predicateName(const Predicate &predicate) {
+        switch (predicate) {
+            case Predicate::Happy: return "happy";
+            case Predicate::Prime: return "prime";
+            case Predicate::Palindrome: return "palindrome";
+            case Predicate::Residue: return "residue";
+            case Predicate::DigitPattern: return "digit pattern";
+            case Predicate::Height: return "height";
+        }
+        return "unknown";
+    }
+
+    /**
+     * Deterministically checks whether a 64-bit number is prime using Miller-Rabin
+     */
+    static bool isPrime(const std::uint64_t &n) {
+        if (n < 2) {
+            return false;
+        }
+        for (const std::uint64_t p : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37}) {
+            if (n%p == 0) {
+                return n == p;
+            }
+        }
+        std::uint64_t d = n-1;
+        int r = 0;
+        for (; d%2 == 0; r++) {
+            d /= 2;
+        }
+        const auto mulMod = [&n](const std::uint64_t x, const std::uint64_t y) {
+            return static_cast<std::uint64_t>(static_cast<unsigned __int128>(x)*y % n);
+        };
+        for (const std::uint64_t a : {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37}) {
+            std::uint64_t x = 1;
+            for (std::uint64_t power = a, e = d; e > 0; e >>= 1, power = mulMod(power, power)) {
+                if (e & 1) {
+                    x = mulMod(x, power);
+                }
+            }
+            if (x == 1 || x == n-1) {
+                continue;
+            }
+            bool composite = true;
+            for (int i = 1; i < r && composite; i++) {
+                x = mulMod(x, x);
+                composite = x != n-1;
+            }
+            if (composite) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Gets the digits of a number, most significant first
+     */
+    std::vector<char> digitsOf(std::uint64_t n) const {
+        std::vector<char> digits;
+        for (; n > 0; n /= calculator.base) {
+            digits.insert(digits.begin(), static_cast<char>(n%calculator.base));
+        }
+        return digits;
+    }
+
+    /**
+     * Checks whether a number satisfies a condition
+     */
+    bool test(const Condition &condition, const std::uint64_t &n) const {
+        switch (condition.predicate) {
+            case Predicate::Happy:
+                return calculator.computeHappy(n);
+            case Predicate::Prime:
+                return isPrime(n);
+            case Predicate::Palindrome: {
+                const std::vector<char> digits = digitsOf(n);
+                return std::equal(digits.begin(), digits.begin()+digits.size()/2, digits.rbegin());
+            }
+            case Predicate::Residue:
+                return n%condition.a == condition.b;
+            case Predicate::DigitPattern: {
+                std::uint64_t rest = n;
+                for (auto c = condition.pattern.rbegin(); c != condition.pattern.rend(); c++) {
+                    if (*c != '?' && digitValue(*c) != static_cast<char>(rest%calculator.base)) {
+                        return false;
+                    }
+                    rest /= calculator.base;
+                }
+                return rest == 0;
+            }
+            case Predicate::Height:
+                return calculator.height(n) == condition.a;
+        }
+        return false;
+    }
+
+    /**
+     * Estimates the fraction of numbers in a range which satisfy a condition
+     */
+    double selectivity(const Condition &condition, const std::uint64_t &from, const std::uint64_t &to) const {
+        const double rangeSize = static_cast<double>(to-from)+1;
+        switch (condition.predicate) {
+            case Predicate::Happy:
+            case Predicate::Height: {
+                // The digit DP gives the exact count of happy numbers in milliseconds
+                const double happyCount = static_cast<double>(
+                        calculator.countHappy(to)-(from == 0 ? 0 : calculator.countHappy(from-1)));
+                return happyCount/rangeSize/(condition.predicate == Predicate::Height ? 4 : 1);
+            }
+            case Predicate::Prime:
+                return 1/std::log(static_cast<double>(std::max<std::uint64_t>(to, 3)));
+            case Predicate::Palindrome:
+            case Predicate::DigitPattern:
+                return std::min(1.0, generatorFor(condition, from, to)->candidates/rangeSize);
+            case Predicate::Residue:
+                return 1.0/static_cast<double>(condition.a);
+        }
+        return 1;
+    }
+
+    /**
+     * Estimates the relative cost of testing a single number against a condition
+     */
+    static double cost(const Condition &condition) {
+        switch (condition.predicate) {
+            case Predicate::Residue: return 1;
+            case Predicate::Palindrome: return 4;
+            case Predicate::DigitPattern: return 4;
+            case Predicate::Happy: return 8;
+            case Predicate::Height: return 12;
+            case Predicate::Prime: return 40;
+        }
+        return 1;
+    }
+
+    /**
+     * Creates a generator which produces a candidate for every index, found by a function of the index
+     *
+     * The function gives nothing for an index whose candidate would not fit in 64 bits, and that index is skipped
+     *
+     * A count of 2^64 indices (such as a range covering every 64-bit number) does not fit in the generator's size, so
+     * the size saturates at 2^64-1 and the last index is also produced by whichever slice ends there
+     *
+     * @param count How many indices there are, which must be at most 2^64
+     */
+    static Generator indexed(const std::string &name, const unsigned __int128 &count, const std::function<std::optional<std::uint64_t>(std::uint64_t)> &at) {
+        const bool saturated = count > UINT64_MAX;
+        const std::uint64_t size = saturated ? UINT64_MAX : static_cast<std::uint64_t>(count);
+        return {name, size, static_cast<double>(count), [at, saturated](const std::uint64_t begin, const std::uint64_t end, const Visitor &visit) {
+            for (std::uint64_t i = begin; i < end; i++) {
+                if (const std::optional<std::uint64_t> candidate = at(i)) {
+                    visit(candidate.value());
+                }
+            }
+            if (saturated && end == UINT64_MAX) {
+                if (const std::optional<std::uint64_t> candidate = at(UINT64_MAX)) {
+                    visit(candidate.value());
+                }
+            }
+        }, std::nullopt};
+    }
+
+    /**
+     * Creates a generator of the happy numbers in a range, where each index is a happy number
+     *
+     * The first happy number of each slice of indices is found by nthHappy, and the rest by happyBitmap from there
+     */
+    Generator happyGenerator(const std::uint64_t &from, const std::uint64_t &to) const {
+        const std::uint64_t before = from == 0 ? 0 : calculator.countHappy(from-1);
+        const std::uint64_t size = calculator.countHappy(to)-before;
+        const HnCalculator &happyCalculator = calculator;
+        return {"happy numbers", size, static_cast<double>(size), [&happyCalculator, before, to](const std::uint64_t begin, const std::uint64_t end, const Visitor &visit) {
+            if (begin >= end) {
+                return;
+            }
+            constexpr std::uint64_t chunkSize = 1 << 20;
+            std::uint64_t remaining = end-begin;
+            for (std::uint64_t chunkFrom = happyCalculator.nthHappy(before+begin+1).value(); remaining > 0; chunkFrom += chunkSize) {
+                const std::uint64_t chunkTo = to-chunkFrom < chunkSize ? to : chunkFrom+chunkSize-1;
+                const std::vector<bool> bitmap = happyCalculator.happyBitmap(chunkFrom, chunkTo);
+                for (std::uint64_t i = 0; i < bitmap.size() && remaining > 0; i++) {
+                    if (bitmap[i]) {
+                        visit(chunkFrom+i);
+                        remaining--;
+                    }
+                }
+                if (chunkTo == to) {
+                    break;
+                }
+            }
+        }, std::nullopt};
+    }
+
+    /**
+     * Creates a generator of the primes in a range by a segmented sieve, where each index is a number in the range
+     *
+     * @return The generator, or nothing if the range goes beyond MAX_SIEVED
+     */
+    static std::optional<Generator> primeGenerator(const std::uint64_t &from, const std::uint64_t &to) {
+        if (to > MAX_SIEVED) {
+            return std::nullopt;
+        }
+        // Primes up to the square root of to, which are shared by every segment and only found once the generator is used
+        auto sievingPrimes = std::make_shared<std::pair<std::once_flag,std::vector<std::uint64_t>>>();
+        const std::uint64_t size = to-from+1;
+        const double candidates = static_cast<double>(size)/std::log(static_cast<double>(std::max<std::uint64_t>(to, 3)));
+        return Generator{"prime sieve", size, candidates, [sievingPrimes, from, to](const std::uint64_t begin, const std::uint64_t end, const Visitor &visit) {
+            std::call_once(sievingPrimes->first, [&sievingPrimes, &to] {
+                const std::uint64_t root = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(to)))+1;
+                std::vector<bool> composite(root+1, false);
+                for (std::uint64_t p = 2; p <= root; p++) {
+                    if (!composite[p]) {
+                        sievingPrimes->second.push_back(p);
+                        for (std::uint64_t multiple = p*p; multiple <= root; multiple += p) {
+                            composite[multiple] = true;
+                        }
+                    }
+                }
+            });
+            for (std::uint64_t segmentStart = from+begin; segmentStart < from+end; segmentStart += SIEVE_SEGMENT) {
+                const std::uint64_t segmentEnd = std::min(from+end, segmentStart+SIEVE_SEGMENT);
+                std::vector<bool> isComposite(segmentEnd-segmentStart, false);
+                for (const std::uint64_t &p : sievingPrimes->second) {
+                    if (p*p >= segmentEnd) {
+                        break;
+                    }
+                    for (std::uint64_t multiple = std::max(p*p, (segmentStart+p-1)/p*p); multiple < segmentEnd; multiple += p) {
+                        isComposite[multiple-segmentStart] = true;
+                    }
+                }
+                for (std::uint64_t n = std::max<std::uint64_t>(segmentStart, 2); n < segmentEnd; n++) {
+                    if (!isComposite[n-segmentStart]) {
+                        visit(n);
+                    }
+                }
+            }
+        }, std::nullopt};
+    }
+
+    /**
+     * Creates a generator which enumerates exactly the numbers satisfying a condition, if the condition supports one
+     *
+     * Height has no generator of its own, since the happy numbers of a given height are not counted by the digit DP
+     */
+    std::optional<Generator> generatorFor(const Condition &condition, const std::uint64_t &from, const std::uint64_t &to) const {
+        const std::uint64_t base = calculator.base;
+        switch (condition.predicate) {
+            case Predicate::Residue: {
+                // Written so that neither the offset to the first member nor from plus it can wrap
+                const std::uint64_t offset = condition.b >= from%condition.a ? condition.b-from%condition.a
+                                                                             : condition.a-(from%condition.a-condition.b);
+                const std::uint64_t first = from+offset;
+                const unsigned __int128 size = offset > to-from ? 0 : static_cast<unsigned __int128>((to-first)/condition.a)+1;
+                const std::uint64_t step = condition.a;
+                return indexed("residue class", size, [first, step](const std::uint64_t i) -> std::optional<std::uint64_t> {
+                    return first+i*step;
+                });
+            }
+            case Predicate::Palindrome: {
+                // Palindromes of each length are enumerated by their first half, shortest lengths first
+                const std::size_t minLength = std::max<std::size_t>(digitsOf(from).size(), 1);
+                const std::size_t maxLength = std::max<std::size_t>(digitsOf(to).size(), 1);
+                std::vector<std::uint64_t> lengthSizes;
+                std::uint64_t size = 0;
+                for (std::size_t length = minLength; length <= maxLength; length++) {
+                    std::uint64_t halves = length == 1 ? base : base-1;
+                    for (std::size_t i = 1; i < (length+1)/2; i++) {
+                        halves *= base;
+                    }
+                    lengthSizes.push_back(halves);
+                    size += halves;
+                }
+                // The longest palindromes may not fit in 64 bits, in which case they are skipped
+                return indexed("palindromes", size, [base, minLength, lengthSizes](std::uint64_t i) -> std::optional<std::uint64_t> {
+                    std::size_t length = minLength;
+                    for (const std::uint64_t &lengthSize : lengthSizes) {
+                        if (i < lengthSize) {
+                            break;
+                        }
+                        i -= lengthSize;
+                        length++;
+                    }
+                    std::uint64_t firstHalf = i;
+                    if (length > 1) {
+                        std::uint64_t lowest = 1;
+                        for (std::size_t j = 1; j < (length+1)/2; j++) {
+                            lowest *= base;
+                        }
+                        firstHalf += lowest;
+                    }
+                    std::uint64_t n = firstHalf;
+                    for (std::uint64_t mirror = length%2 == 1 ? firstHalf/base : firstHalf; mirror > 0; mirror /= base) {
+                        if (__builtin_mul_overflow(n, base, &n) || __builtin_add_overflow(n, mirror%base, &n)) {
+                            return std::nullopt;
+                        }
+                    }
+                    return n;
+                });
+            }
+            case Predicate::DigitPattern: {
+                // Wildcards are filled with the digits of the index, so the most significant wildcard changes slowest. An
+                // index is never more than the number it fills in, so 2^64 indices cover every match which fits in 64 bits
+                unsigned __int128 size = 1;
+                for (const char &c : condition.pattern) {
+                    if (c == '?') {
+                        size = std::min<unsigned __int128>(size*base, static_cast<unsigned __int128>(1) << 64);
+                    }
+                }
+                const std::string pattern = condition.pattern;
+                return indexed("digit pattern", size, [base, pattern](std::uint64_t i) -> std::optional<std::uint64_t> {
+                    std::uint64_t n = 0;
+                    std::uint64_t place = 1;
+                    // Once the place value no longer fits, only zero digits do
+                    bool placeOverflowed = false;
+                    for (auto c = pattern.rbegin(); c != pattern.rend(); c++) {
+                        std::uint64_t digit = 0;
+                        if (*c == '?') {
+                            digit = i%base;
+                            i /= base;
+                        } else {
+                            digit = digitValue(*c);
+                        }
+                        std::uint64_t value = 0;
+                        if (digit != 0 && (placeOverflowed || __builtin_mul_overflow(digit, place, &value)
+                                           || __builtin_add_overflow(n, value, &n))) {
+                            return std::nullopt;
+                        }
+                        placeOverflowed = placeOverflowed || __builtin_mul_overflow(place, base, &place);
+                    }
+                    return n;
+                });
+            }
+            case Predicate::Happy:
+                return happyGenerator(from, to);
+            case Predicate::Prime:
+                return primeGenerator(from, to);
+            default:
+                return std::nullopt;
+        }
+    }
+
+    /**
+     * Picks the generator which will produce the fewest candidates, falling back to scanning the whole range
+     */
+    Generator chooseGenerator(const std::uint64_t &from, const std::uint64_t &to) const {
+        Generator best = indexed("range scan", static_cast<unsigned __int128>(to-from)+1, [from](const std::uint64_t i) -> std::optional<std::uint64_t> {
+            return from+i;
+        });
+        for (std::size_t i = 0; i < conditions.size(); i++) {
+            std::optional<Generator> generator = generatorFor(conditions[i], from, to);
+            if (generator && generator->candidates < best.candidates) {
+                best = *generator;
+                best.satisfies = i;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Orders the conditions not already guaranteed by a generator so that cheap, selective filters are tested first
+     */
+    std::vector<std::size_t> orderFilters(const std::uint64_t &from, const std::uint64_t &to, const Generator &generator) const {
+        std::vector<std::pair<double,std::size_t>> ranked;
+        for (std::size_t i = 0; i < conditions.size(); i++) {
+            if (generator.satisfies != i) {
+                ranked.emplace_back(cost(conditions[i])/std::max(1-selectivity(conditions[i], from, to), 1e-9), i);
+            }
+        }
+        std::sort(ranked.begin(), ranked.end());
+        std::vector<std::size_t> filters;
+        for (const std::pair<double,std::size_t> &rank : ranked) {
+            filters.push_back(rank.second);
+        }
+        return filters;
+    }
+};
+
+
+/**
+ * Chooses how to calculate a given output over a given range, out of the several engines available
+ *
+ * The chosen plan is kept in lastPlan so that it can be reported, and can be overridden with forcedEngine
+ */
+class HnPlanner {
+public:
+    /**
+     * What the caller wants to know about the range
+     */
+    enum class Output {
+        Count,
+        Sum,
+        List,
+        Bitmap,
+        Point
+    };
+
+    /**
+     * The ways in which results can be calculated
+     */
+    enum class Engine {
+        /**
+         * HnCalculator::countHappy and friends
+         */
+        DigitDp,
+        /**
+         * HnCalculator::countHappyBelowPower, only for counts below a power of the base
+         *
+         * This is never chosen by plan, since the digit DP is just as quick for any range which fits in 64 bits, so it is
+         * only used through forcedEngine, for benchmarking
+         */
+        PowerConvolution,
+        /**
+         * Enumerating sorted digit multisets and counting their permutations, only for counts below a power of the base
+         *
+         * This is never chosen by plan, since the number of multisets grows far faster than the DP's states in every base
+         * but 2, so it is only used through forcedEngine, for benchmarking
+         */
+        MultisetExpansion,
+        /**
+         * HnCalculator::happyBitmap
+         */
+        Bitmap,
+        /**
+         * Calculating every number individually, like threadLoop
+         */
+        Scan
+    };
+
+    /**
+     * A chosen engine along with why it was chosen
+     */
+    struct Plan {
+        Engine engine;
+        std::string reason;
+    };
+
+    /**
+     * Ranges at most this big are calculated directly, since setting up anything cleverer costs more
+     */
+    static constexpr std::uint64_t SMALL_RANGE = 1 << 16;
+
+    /**
+     * If set, this engine is always used (throwing if it cannot produce the requested output exactly), for benchmarking
+     */
+    std::optional<Engine> forcedEngine;
+    /**
+     * The plan used by the most recent query
+     */
+    std::optional<Plan> lastPlan;
+
+private:
+    const HnCalculator &calculator;
+
+public:
+    explicit HnPlanner(const HnCalculator &calculator) : calculator(calculator) {}
+
+    /**
+     * Gets a human-readable name for an engine
+     */
+    static const char *engineName(const Engine &engine) {
+        switch (engine) {
+            case Engine::DigitDp: return "digit DP";
+            case Engine::PowerConvolution: return "power convolution";
+            case Engine::MultisetExpansion: return "multiset expansion";
+            case Engine::Bitmap: return "bitmap";
+            case Engine::Scan: return "scan";
+        }
+        return "unknown";
+    }
+
+    /**
+     * Chooses an engine for calculating a given output over a given range
+     *
+     * @param from The first number of the range
+     * @param to The last number of the range
+     * @param output What must be calculated
+     * @return The chosen engine and why
+     */
+    Plan plan(const std::uint64_t &from, const std::uint64_t &to, const Output &output) const {
+        if (from > to) {
+            throw std::invalid_argument("from must not be greater than to");
+        }
+        if (forcedEngine) {
+            if (!supports(forcedEngine.value(), output, from, to)) {
+                throw std::invalid_argument(std::string("the ")+engineName(forcedEngine.value())+" engine cannot produce this output");
+            }
+            return {forcedEngine.value(), "forced"};
+        }
+        const std::uint64_t rangeSize = to-from;
+        switch (output) {
+            case Output::Point:
+                return {Engine::Scan, "a single number only needs a few iterations"};
+            case Output::List:
+            case Output::Bitmap:
+                return {Engine::Bitmap, "every number must be produced, and the bitmap needs one iteration per number"};
+            case Output::Count:
+            case Output::Sum:
+                if (rangeSize < SMALL_RANGE) {
+                    return {Engine::Bitmap, "the range is small enough that the DP setup would dominate"};
+                }
+                return {Engine::DigitDp, "the DP takes milliseconds regardless of the size of the range"};
+        }
+        return {Engine::Scan, "fallback"};
+    }
+
+    /**
+     * Counts the happy numbers in [from, to]
+     */
+    std::uint64_t count(const std::uint64_t &from, const std::uint64_t &to) {
+        lastPlan = plan(from, to, Output::Count);
+        switch (lastPlan->engine) {
+            case Engine::DigitDp:
+                return calculator.countHappy(to)-(from == 0 ? 0 : calculator.countHappy(from-1));
+            case Engine::PowerConvolution:
+                return static_cast<std::uint64_t>(calculator.countHappyBelowPower(powerDigits(to)));
+            case Engine::MultisetExpansion:
+                return multisetCount(powerDigits(to));
+            case Engine::Bitmap: {
+                const std::vector<bool> bitmap = calculator.happyBitmap(from, to);
+                return std::count(bitmap.begin(), bitmap.end(), true);
+            }
+            case Engine::Scan:
+                break;
+        }
+        std::uint64_t happyCount = 0;
+        for (std::uint64_t n = from; n <= to && n >= from; n++) {
+            happyCount += calculator.computeHappy(n);
+        }
+        return happyCount;
+    }
+
+    /**
+     * Sums the happy numbers in [from, to]
+     */
+    unsigned __int128 sum(const std::uint64_t &from, const std::uint64_t &to) {
+        lastPlan = plan(from, to, Output::Sum);
+        if (lastPlan->engine == Engine::DigitDp) {
+            return calculator.sumHappy(to)-(from == 0 ? 0 : calculator.sumHappy(from-1));
+        }
+        unsigned __int128 happySum = 0;
+        for (const std::uint64_t &n : listWith(lastPlan->engine, from, to)) {
+            happySum += n;
+        }
+        return happySum;
+    }
+
+    /**
+     * Lists the happy numbers in [from, to]
+     */
+    std::vector<std::uint64_t> list(const std::uint64_t &from, const std::uint64_t &to) {
+        lastPlan = plan(from, to, Output::List);
+        return listWith(lastPlan->engine, from, to);
+    }
+
+    /**
+     * Calculates the happiness of every number in [from, to]
+     */
+    std::vector<bool> bitmap(const std::uint64_t &from, const std::uint64_t &to) {
+        lastPlan = plan(from, to, Output::Bitmap);
+        if (lastPlan->engine == Engine::Bitmap) {
+            return calculator.happyBitmap(from, to);
+        }
+        std::vector<bool> result(to-from+1);
+        for (std::uint64_t n = from; n <= to && n >= from; n++) {
+            result[n-from] = calculator.computeHappy(n);
+        }
+        return result;
+    }
+
+    /**
+     * Determines whether a single number is happy
+     */
+    bool point(const std::uint64_t &n) {
+        lastPlan = plan(n, n, Output::Point);
+        switch (lastPlan->engine) {
+            case Engine::DigitDp:
+                return calculator.countHappy(n)-(n == 0 ? 0 : calculator.countHappy(n-1)) == 1;
+            case Engine::Bitmap:
+                return calculator.happyBitmap(n, n)[0];
+            default:
+                return calculator.computeHappy(n);
+        }
+    }
+
+private:
+    /**
+     * Determines whether an engine can produce a given output over a given range
+     */
+    bool supports(const Engine &engine, const Output &output, const std::uint64_t &from, const std::uint64_t &to) const {
+        switch (engine) {
+            case Engine::DigitDp:
+                return output == Output::Count || output == Output::Sum || output == Output::Point;
+            case Engine::PowerConvolution:
+                // Counts beyond the product of the NTT primes would only be known modulo it
+                return output == Output::Count && from <= 1 && powerDigits(to) != 0
+                       && calculator.isPowerCountExact(powerDigits(to));
+            case Engine::MultisetExpansion:
+                // This only knows how many numbers below a power of the base reach each sum
+                return output == Output::Count && from <= 1 && powerDigits(to) != 0;
+            case Engine::Bitmap:
+            case Engine::Scan:
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * Gets k such that n is base^k-1
+     *
+     * @return k, or 0 if n is not one less than a power of the base
+     */
+    std::uint64_t powerDigits(std::uint64_t n) const {
+        std::uint64_t digits = 0;
+        for (; n > 0; n /= calculator.base, digits++) {
+            if (n%calculator.base != static_cast<std::uint64_t>(calculator.base-1)) {
+                return 0;
+            }
+        }
+        return digits;
+    }
+
+    /**
+     * Lists the happy numbers in [from, to] using an engine which can produce every number
+     */
+    std::vector<std::uint64_t> listWith(const Engine &engine, const std::uint64_t &from, const std::uint64_t &to) const {
+        std::vector<std::uint64_t> happyNumbers;
+        if (engine == Engine::Bitmap) {
+            const std::vector<bool> bitmap = calculator.happyBitmap(from, to);
+            for (std::uint64_t i = 0; i < bitmap.size(); i++) {
+                if (bitmap[i]) {
+                    happyNumbers.push_back(from+i);
+                }
+            }
+            return happyNumbers;
+        }
+        for (std::uint64_t n = from; n <= to && n >= from; n++) {
+            if (calculator.computeHappy(n)) {
+                happyNumbers.push_back(n);
+            }
+        }
+        return happyNumbers;
+    }
+
+    /**
+     * Counts the happy numbers below base^digits by enumerating each multiset of digits once and adding how many
+     * distinct numbers its digits can be arranged into
+     */
+    std::uint64_t multisetCount(const std::uint64_t &digits) const {
+        std::vector<std::uint64_t> digitCounts(calculator.base, 0);
+        std::uint64_t happyCount = 0;
+        const std::function<void(char,std::uint64_t,std::uint64_t,std::uint64_t)> enumerate =
+                [&](const char digit, const std::uint64_t remaining, const std::uint64_t sum, const std::uint64_t arrangements) {
+            if (digit == calculator.base-1) {
+                // The remaining positions are all the last digit, which leaves only one way to arrange them
+                const std::uint64_t finalSum = sum+remaining*digit*digit;
+                if (finalSum != 0 && calculator.computeHappy(finalSum)) {
+                    happyCount += arrangements;
+                }
+                return;
+            }
+            // Choosing positions for this digit out of those remaining; binomials are built incrementally
+            std::uint64_t choices = 1;
+            for (std::uint64_t count = 0; count <= remaining; count++) {
+                enumerate(static_cast<char>(digit+1), remaining-count, sum+count*digit*digit, arrangements*choices);
+                choices = static_cast<std::uint64_t>(static_cast<unsigned __int128>(choices)*(remaining-count)/(count+1));
+            }
+        };
+        enumerate(0, digits, 0, 1);
+        return happyCount;
+    }
+};
+
+
+/**
+ * Calculates the 64-bit FNV-1a hash of some bytes, used for checksumming files
+ *
+ * @param data The bytes to hash
+ * @param size How many bytes to hash
+ * @return The hash of the bytes
+ */
+std::uint64_t fnv1a(const std::uint8_t *data, const std::size_t &size) {
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (std::size_t i = 0; i < size; i++) {
+        hash = (hash^data[i])*0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * Appends a value to a buffer as a LEB128 varint, which takes one byte per 7 bits
+ *
+ * @param buffer Where to append the value
+ * @param value The value to append
+ */
+void appendVarint(std::vector<std::uint8_t> &buffer, std::uint64_t value) {
+    for (; value >= 0x80; value >>= 7) {
+        buffer.push_back(static_cast<std::uint8_t>(value | 0x80));
+    }
+    buffer.push_back(static_cast<std::uint8_t>(value));
+}
+
+/**
+ * Reads a LEB128 varint from a buffer
+ *
+ * @param data The buffer to read from, which is advanced past the value
+ * @return The value read
+ */
+std::uint64_t readVarint(const std::uint8_t *&data) {
+    std::uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        const std::uint8_t byte = *data++;
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            return value;
+        }
+    }
+}
+
+/**
+ * A read-only file of prebuilt tables for many bases, mapped into memory so it is shared between processes
+ *
+ * The file starts with a header and a directory of tables, each of which is 64-byte aligned and checksummed
+ */
+class HnTablePack {
+public:
+    /**
+     * The kinds of table a pack can contain
+     */
+    enum class Kind : std::uint8_t {
+        /**
+         * HnCalculator::happinessTable
+         */
+        Happiness,
+        /**
+         * HnCalculator::heightTable
+         */
+        Height,
+        /**
+         * HnCalculator::digitChunkTable
+         */
+        DigitChunk
+    };
+
+    /**
+     * A table within a mapped pack
+     */
+    struct Table {
+        const std::uint8_t *data;
+        std::size_t size;
+    };
+
+    /**
+     * Increased whenever the layout of packs or their tables changes
+     */
+    static constexpr std::uint32_t VERSION = 1;
+
+private:
+    struct Header {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t tableCount;
+        std::uint64_t directoryChecksum;
+    };
+
+    struct DirectoryEntry {
+        std::uint8_t base;
+        Kind kind;
+        std::uint8_t reserved[6];
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint64_t checksum;
+    };
+
+    const std::uint8_t *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    std::vector<DirectoryEntry> directory;
+
+public:
+    /**
+     * Maps a pack into memory and verifies it
+     *
+     * @param path Where the pack was written by write
+     */
+    explicit HnTablePack(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("could not open table pack "+path);
+        }
+        struct stat info{};
+        if (fstat(fd, &info) == -1 || static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("table pack "+path+" is too small");
+        }
+        mappingSize = info.st_size;
+        void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("could not map table pack "+path);
+        }
+        mapping = static_cast<const std::uint8_t*>(address);
+        try {
+            verify();
+        } catch (...) {
+            munmap(const_cast<std::uint8_t*>(mapping), mappingSize);
+            throw;
+        }
+    }
+
+    HnTablePack(const HnTablePack&) = delete;
+    HnTablePack &operator=(const HnTablePack&) = delete;
+
+    ~HnTablePack() {
+        munmap(const_cast<std::uint8_t*>(mapping), mappingSize);
+    }
+
+    /**
+     * Finds a table within the pack
+     *
+     * @param base The base the table was built for
+     * @param kind The kind of table
+     * @return The table, or nothing if the pack does not contain it
+     */
+    std::optional<Table> find(const char &base, const Kind &kind) const {
+        for (const DirectoryEntry &entry : directory) {
+            if (entry.base == static_cast<std::uint8_t>(base) && entry.kind == kind) {
+                return Table{mapping+entry.offset, entry.size};
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * Builds every kind of table for each of the given bases and writes them as a pack
+     *
+     * @param path Where to write the pack
+     * @param bases The bases to build tables for
+     */
+    static void write(const std::string &path, const std::vector<char> &bases) {
+        std::vector<DirectoryEntry> entries;
+        std::vector<std::vector<std::uint8_t>> tables;
+        for (const char &base : bases) {
+            for (const Kind kind : {Kind::Happiness, Kind::Height, Kind::DigitChunk}) {
+                tables.push_back(build(base, kind));
+                entries.push_back({static_cast<std::uint8_t>(base), kind, {}, 0, 0, 0});
+            }
+        }
+        std::uint64_t offset = alignTable(sizeof(Header)+entries.size()*sizeof(DirectoryEntry));
+        for (std::size_t i = 0; i < entries.size(); i++) {
+            entries[i].offset = offset;
+            entries[i].size = tables[i].size();
+            entries[i].checksum = fnv1a(tables[i].data(), tables[i].size());
+            offset = alignTable(offset+tables[i].size());
+        }
+        Header header{{'H','N','T','P'}, VERSION, entries.size(),
+                      fnv1a(reinterpret_cast<const std::uint8_t*>(entries.data()), entries.size()*sizeof(DirectoryEntry))};
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size()*sizeof(DirectoryEntry)));
+        for (std::size_t i = 0; i < entries.size(); i++) {
+            const std::string padding(entries[i].offset-file.tellp(), '\0');
+            file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+            file.write(reinterpret_cast<const char*>(tables[i].data()), static_cast<std::streamsize>(tables[i].size()));
+        }
+        if (!file) {
+            throw std::runtime_error("could not write table pack "+path);
+        }
+    }
+
+    /**
+     * Builds a table as it would be stored in a pack
+     *
+     * @param base The base to build the table for
+     * @param kind The kind of table to build
+     * @return The bytes of the table
+     */
+    static std::vector<std::uint8_t> build(const char &base, const Kind &kind) {
+        const HnCalculator calculator(false, false, base);
+        switch (kind) {
+            case Kind::Happiness:
+                return calculator.happinessTable();
+            case Kind::Height:
+                return calculator.heightTable();
+            case Kind::DigitChunk: {
+                const std::vector<std::uint16_t> chunks = calculator.digitChunkTable();
+                return {reinterpret_cast<const std::uint8_t*>(chunks.data()),
+                        reinterpret_cast<const std::uint8_t*>(chunks.data()+chunks.size())};
+            }
+        }
+        return {};
+    }
+
+private:
+    /**
+     * Rounds an offset up to the next cache line
+     */
+    static std::uint64_t alignTable(const std::uint64_t &offset) {
+        return (offset+63)/64*64;
+    }
+
+    /**
+     * Checks the header, directory and every table of the mapped pack, and reads the directory
+     */
+    void verify() {
+        Header header{};
+        std::memcpy(&header, mapping, sizeof(header));
+        if (std::memcmp(header.magic, "HNTP", 4) != 0) {
+            throw std::runtime_error("not a table pack");
+        } else if (header.version != VERSION) {
+            throw std::runtime_error("table pack version "+std::to_string(header.version)+" is not supported");
+        } else if (header.tableCount > (mappingSize-sizeof(Header))/sizeof(DirectoryEntry)) {
+            throw std::runtime_error("table pack directory is truncated");
+        }
+        directory.resize(header.tableCount);
+        std::memcpy(directory.data(), mapping+sizeof(Header), directory.size()*sizeof(DirectoryEntry));
+        if (fnv1a(mapping+sizeof(Header), directory.size()*sizeof(DirectoryEntry)) != header.directoryChecksum) {
+            throw std::runtime_error("table pack directory is corrupt");
+        }
+        for (const DirectoryEntry &entry : directory) {
+            if (entry.offset > mappingSize || entry.size > mappingSize-entry.offset) {
+                throw std::runtime_error("table pack is truncated");
+            } else if (fnv1a(mapping+entry.offset, entry.size) != entry.checksum) {
+                throw std::runtime_error("table pack is corrupt");
+            }
+        }
+    }
+};
+
+
+/**
+ * Process-wide registry of immutable tables, so that every calculator for the same base shares one copy
+ *
+ * Each table is built the first time it is requested, or taken from a table pack if one has been supplied, and is
+ * kept alive for as long as anything holds it
+ */
+class HnTableRegistry {
+public:
+    /**
+     * A reference-counted view of a table in the registry
+     */
+    using TableRef = std::shared_ptr<const HnTablePack::Table>;
+
+private:
+    /**
+     * A table which may not have been built yet
+     */
+    struct Entry {
+        std::once_flag built;
+        std::vector<std::uint8_t> storage;
+        /**
+         * The pack the table lives in, if it was not built, which must stay mapped while the table is held
+         */
+        std::shared_ptr<const HnTablePack> pack;
+        HnTablePack::Table table{};
+    };
+
+    inline static std::mutex entriesLock;
+    inline static std::map<std::pair<char,HnTablePack::Kind>,std::shared_ptr<Entry>> entries;
+    inline static std::shared_ptr<const HnTablePack> pack;
+
+public:
+    /**
+     * Gets a table, building it if no calculator has needed it yet
+     *
+     * Only the registry itself is locked while looking up the entry, so different tables can be built concurrently
+     *
+     * @param base The base the table is for
+     * @param kind The kind of table
+     * @return The table
+     */
+    static TableRef get(const char &base, const HnTablePack::Kind &kind) {
+        entriesLock.lock();
+        std::shared_ptr<Entry> &slot = entries[{base, kind}];
+        if (!slot) {
+            slot = std::make_shared<Entry>();
+        }
+        const std::shared_ptr<Entry> entry = slot;
+        const std::shared_ptr<const HnTablePack> currentPack = pack;
+        entriesLock.unlock();
+        std::call_once(entry->built, [&] {
+            const std::optional<HnTablePack::Table> packed = currentPack ? currentPack->find(base, kind) : std::nullopt;
+            if (packed) {
+                entry->pack = currentPack;
+                entry->table = packed.value();
+            } else {
+                entry->storage = HnTablePack::build(base, kind);
+                entry->table = {entry->storage.data(), entry->storage.size()};
+            }
+        });
+        return {entry, &entry->table};
+    }
+
+    /**
+     * Serves tables from a pack from now on, rather than building them
+     *
+     * Tables which have already been handed out are kept as they are
+     *
+     * @param tablePack The pack to serve tables from
+     */
+    static void usePack(std::shared_ptr<const HnTablePack> tablePack) {
+        entriesLock.lock();
+        pack = std::move(tablePack);
+        entriesLock.unlock();
+    }
+};
+
+std::vector<bool> HnCalculator::happyBitmap(const std::uint64_t &from, const std::uint64_t &to) const {
+    const HnTableRegistry::TableRef table = HnTableRegistry::get(base, HnTablePack::Kind::Happiness);
+    return happyBitmap(from, to, table->data);
+}
+
+
+/**
+ * A columnar file of per-number results, for analysis jobs which only need some columns or some of the range
+ *
+ * Rows are split into row groups of ROW_GROUP_SIZE numbers, and each column of each row group is encoded separately
+ * with whichever lightweight encoding suits it. The footer holds a zone map (min, max and how many values are
+ * non-zero) for every column chunk, so readers can skip row groups without decoding them
+ */
+class HnColumnarFile {
+public:
+    /**
+     * The columns stored for each number
+     */
+    enum class Column : std::uint8_t {
+        /**
+         * 1 if the number is happy, otherwise 0
+         */
+        Happy,
+        /**
+         * HnCalculator::height, or UINT8_MAX if the number is not happy
+         */
+        Height,
+        /**
+         * HnCalculator::cycleEntry
+         */
+        CycleEntry,
+        /**
+         * HnCalculator::sortDigits, which is the same for every permutation of a number's digits
+         */
+        CanonicalKey
+    };
+
+    /**
+     * How a column chunk is encoded
+     */
+    enum class Encoding : std::uint8_t {
+        /**
+         * Values minus the chunk's minimum, packed into as few bits as the largest needs
+         */
+        BitPacked,
+        /**
+         * Varint pairs of value and how many times it repeats
+         */
+        RunLength,
+        /**
+         * The first value then zigzag-encoded differences, all as varints
+         */
+        Delta
+    };
+
+    /**
+     * Describes a column chunk, and is all that needs to be read to decide whether to decode it
+     */
+    struct ZoneMap {
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint64_t min;
+        std::uint64_t max;
+        std::uint64_t nonZero;
+        Encoding encoding;
+        std::uint8_t reserved[7];
+    };
+
+    static constexpr std::uint64_t ROW_GROUP_SIZE = 1 << 16;
+    static constexpr std::size_t COLUMNS = 4;
+    static constexpr std::uint32_t VERSION = 1;
+
+private:
+    struct Header {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t base;
+        std::uint64_t from;
+        std::uint64_t to;
+        std::uint64_t rowGroupSize;
+    };
+
+    struct Trailer {
+        std::uint64_t footerOffset;
+        std::uint64_t rowGroups;
+        std::uint64_t footerChecksum;
+        char magic[4];
+        std::uint32_t version;
+    };
+
+    Header header{};
+    std::vector<ZoneMap> zoneMaps;
+    std::ifstream file;
+
+public:
+    /**
+     * Opens a columnar file and reads its zone maps
+     *
+     * @param path Where the file was written by write
+     */
+    explicit HnColumnarFile(const std::string &path) : file(path, std::ios::binary) {
+        Trailer trailer{};
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        file.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end);
+        file.read(reinterpret_cast<char*>(&trailer), sizeof(trailer));
+        if (!file || std::memcmp(header.magic, "HNCF", 4) != 0 || std::memcmp(trailer.magic, "HNCF", 4) != 0) {
+            throw std::runtime_error("not a columnar result file "+path);
+        } else if (header.version != VERSION || trailer.version != VERSION) {
+            throw std::runtime_error("columnar file version "+std::to_string(header.version)+" is not supported");
+        }
+        zoneMaps.resize(trailer.rowGroups*COLUMNS);
+        file.seekg(static_cast<std::streamoff>(trailer.footerOffset));
+        file.read(reinterpret_cast<char*>(zoneMaps.data()), static_cast<std::streamsize>(zoneMaps.size()*sizeof(ZoneMap)));
+        if (!file || fnv1a(reinterpret_cast<const std::uint8_t*>(zoneMaps.data()), zoneMaps.size()*sizeof(ZoneMap)) != trailer.footerChecksum) {
+            throw std::runtime_error("columnar file footer is corrupt");
+        }
+    }
+
+    /**
+     * Gets how many row groups the file contains
+     */
+    std::uint64_t rowGroups() const {
+        return zoneMaps.size()/COLUMNS;
+    }
+
+    /**
+     * Gets the first number of a row group
+     */
+    std::uint64_t rowGroupStart(const std::uint64_t &rowGroup) const {
+        return header.from+rowGroup*header.rowGroupSize;
+    }
+
+    /**
+     * Gets the zone map of a column chunk
+     */
+    const ZoneMap &zoneMap(const std::uint64_t &rowGroup, const Column &column) const {
+        return zoneMaps[rowGroup*COLUMNS+static_cast<std::size_t>(column)];
+    }
+
+    /**
+     * Decodes a column chunk
+     *
+     * @param rowGroup Which row group to read
+     * @param column Which column to read
+     * @return The value of the column for each number in the row group
+     */
+    std::vector<std::uint64_t> read(const std::uint64_t &rowGroup, const Column &column) {
+        const ZoneMap &zone = zoneMap(rowGroup, column);
+        const std::uint64_t rows = std::min(header.rowGroupSize, header.to-rowGroupStart(rowGroup)+1);
+        std::vector<std::uint8_t> chunk(zone.size+8);
+        file.seekg(static_cast<std::streamoff>(zone.offset));
+        file.read(reinterpret_cast<char*>(chunk.data()), static_cast<std::streamsize>(zone.size));
+        if (!file) {
+            throw std::runtime_error("columnar file is truncated");
+        }
+        return decode(chunk.data(), zone, rows);
+    }
+
+    /**
+     * Calculates every column for every number in [from, to] and writes them as a columnar file
+     *
+     * Row groups are calculated and encoded by separate threads, then written in order
+     *
+     * @param calculator The calculator whose base to use
+     * @param path Where to write the file
+     * @param from The first number to write
+     * @param to The last number to write
+     * @param numThreads The number of threads to encode row groups with
+     */
+    static void write(const HnCalculator &calculator, const std::string &path, const std::uint64_t &from,
+                      const std::uint64_t &to, const std::uint16_t numThreads=HnResources::threads()) {
+        const std::uint64_t rowGroupCount = (to-from)/ROW_GROUP_SIZE+1;
+        const std::uint64_t maxSum = calculator.maxDigitSquareSum();
+        const HnTableRegistry::TableRef happiness = HnTableRegistry::get(calculator.base, HnTablePack::Kind::Happiness);
+        const HnTableRegistry::TableRef heights = HnTableRegistry::get(calculator.base, HnTablePack::Kind::Height);
+        std::vector<std::uint64_t> cycleEntries(maxSum+1);
+        for (std::uint64_t s = 0; s <= maxSum; s++) {
+            cycleEntries[s] = calculator.cycleEntry(s);
+        }
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const Header header{{'H','N','C','F'}, VERSION, static_cast<std::uint64_t>(calculator.base), from, to, ROW_GROUP_SIZE};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<ZoneMap> zoneMaps;
+        std::uint64_t offset = sizeof(header);
+        const std::uint64_t batchSize = std::max<std::uint16_t>(numThreads, 1);
+        for (std::uint64_t batchStart = 0; batchStart < rowGroupCount; batchStart += batchSize) {
+            const std::uint64_t batchEnd = std::min(rowGroupCount, batchStart+batchSize);
+            std::vector<std::array<std::pair<ZoneMap,std::vector<std::uint8_t>>,COLUMNS>> encoded(batchEnd-batchStart);
+            std::vector<std::thread> threads;
+            for (std::uint64_t rowGroup = batchStart; rowGroup < batchEnd; rowGroup++) {
+                threads.emplace_back([&, rowGroup] {
+                    const std::uint64_t groupFrom = from+rowGroup*ROW_GROUP_SIZE;
+                    const std::uint64_t groupTo = std::min(to-groupFrom, ROW_GROUP_SIZE-1)+groupFrom;
+                    std::array<std::vector<std::uint64_t>,COLUMNS> columns;
+                    HN_PROBE(chunk_start, groupFrom, groupTo);
+                    for (std::uint64_t n = groupFrom; ; n++) {
+                        // Numbers no bigger than the largest sum can be looked up directly, which also keeps the
+                        // members of cycles correct; anything bigger is one step away from the tables
+                        const bool direct = n <= maxSum;
+                        const std::uint64_t s = direct ? n : calculator.sumOfDigitSquares(n);
+                        const std::uint8_t height = heights->data[s];
+                        columns[0].push_back(happiness->data[s]);
+                        columns[1].push_back(direct || height == UINT8_MAX ? height : height+1);
+                        columns[2].push_back(cycleEntries[s]);
+                        columns[3].push_back(calculator.sortDigits(n));
+                        if (n == groupTo) {
+                            break;
+                        }
+                    }
+                    HN_PROBE(chunk_end, groupFrom, groupTo);
+                    const Encoding encodings[COLUMNS] = {Encoding::BitPacked, Encoding::RunLength, Encoding::BitPacked, Encoding::Delta};
+                    for (std::size_t column = 0; column < COLUMNS; column++) {
+                        encoded[rowGroup-batchStart][column] = encode(columns[column], encodings[column]);
+                    }
+                });
+            }
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+            for (auto &rowGroup : encoded) {
+                for (auto &[zone, chunk] : rowGroup) {
+                    zone.offset = offset;
+                    offset += chunk.size();
+                    file.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+                    zoneMaps.push_back(zone);
+                }
+            }
+        }
+        const Trailer trailer{offset, rowGroupCount,
+                              fnv1a(reinterpret_cast<const std::uint8_t*>(zoneMaps.data()), zoneMaps.size()*sizeof(ZoneMap)),
+                              {'H','N','C','F'}, VERSION};
+        file.write(reinterpret_cast<const char*>(zoneMaps.data()), static_cast<std::streamsize>(zoneMaps.size()*sizeof(ZoneMap)));
+        file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        if (!file) {
+            throw std::runtime_error("could not write columnar file "+path);
+        }
+    }
+
+private:
+    /**
+     * Encodes a column chunk and calculates its zone map (apart from its offset)
+     */
+    static std::pair<ZoneMap,std::vector<std::uint8_t>> encode(const std::vector<std::uint64_t> &values, const Encoding &encoding) {
+        ZoneMap zone{0, 0, *std::min_element(values.begin(), values.end()), *std::max_element(values.begin(), values.end()),
+                     static_cast<std::uint64_t>(values.size()-std::count(values.begin(), values.end(), 0)), encoding, {}};
+        std::vector<std::uint8_t> chunk;
+        switch (encoding) {
+            case Encoding::BitPacked: {
+                const int width = zone.max == zone.min ? 0 : 64-__builtin_clzll(zone.max-zone.min);
+                chunk.resize((values.size()*width+7)/8, 0);
+                for (std::size_t i = 0; i < values.size(); i++) {
+                    const std::uint64_t value = values[i]-zone.min;
+                    for (int bit = 0; bit < width; bit++) {
+                        chunk[(i*width+bit)/8] |= static_cast<std::uint8_t>(((value >> bit) & 1) << ((i*width+bit)%8));
+                    }
+                }
+                break;
+            }
+            case Encoding::RunLength:
+                for (std::size_t i = 0; i < values.size();) {
+                    std::size_t run = 1;
+                    while (i+run < values.size() && values[i+run] == values[i]) {
+                        run++;
+                    }
+                    appendVarint(chunk, values[i]);
+                    appendVarint(chunk, run);
+                    i += run;
+                }
+                break;
+            case Encoding::Delta: {
+                std::uint64_t previous = 0;
+                for (const std::uint64_t &value : values) {
+                    const std::int64_t difference = static_cast<std::int64_t>(value-previous);
+                    appendVarint(chunk, (static_cast<std::uint64_t>(difference) << 1) ^ static_cast<std::uint64_t>(difference >> 63));
+                    previous = value;
+                }
+                break;
+            }
+        }
+        zone.size = chunk.size();
+        return {zone, chunk};
+    }
+
+    /**
+     * Decodes a column chunk
+     *
+     * @param chunk The encoded chunk, followed by at least 8 bytes of padding
+     */
+    static std::vector<std::uint64_t> decode(const std::uint8_t *chunk, const ZoneMap &zone, const std::uint64_t &rows) {
+        std::vector<std::uint64_t> values;
+        values.reserve(rows);
+        switch (zone.encoding) {
+            case Encoding::BitPacked: {
+                const int width = zone.max == zone.min ? 0 : 64-__builtin_clzll(zone.max-zone.min);
+                const std::uint64_t mask = width == 64 ? UINT64_MAX : (1ULL << width)-1;
+                values.resize(rows);
+                // Each value is a single unaligned 64-bit load and shift (the padding keeps loads inside the chunk), with
+                // no branches for widths of up to 57 bits, so the loop can be vectorised
+                if (width <= 57) {
+                    for (std::uint64_t i = 0; i < rows; i++) {
+                        std::uint64_t word;
+                        std::memcpy(&word, chunk+i*width/8, sizeof(word));
+                        values[i] = zone.min+((word >> (i*width%8)) & mask);
+                    }
+                } else {
+                    // Wider values can straddle 9 bytes, so take the rest from the following byte
+                    for (std::uint64_t i = 0; i < rows; i++) {
+                        std::uint64_t word;
+                        std::memcpy(&word, chunk+i*width/8, sizeof(word));
+                        const unsigned shift = i*width%8;
+                        const std::uint64_t high = shift == 0 ? 0 : static_cast<std::uint64_t>(chunk[i*width/8+8]) << (64-shift);
+                        values[i] = zone.min+(((word >> shift) | high) & mask);
+                    }
+                }
+                break;
+            }
+            case Encoding::RunLength:
+                while (values.size() < rows) {
+                    const std::uint64_t value = readVarint(chunk);
+                    values.insert(values.end(), readVarint(chunk), value);
+                }
+                break;
+            case Encoding::Delta: {
+                std::uint64_t previous = 0;
+                for (std::uint64_t i = 0; i < rows; i++) {
+                    const std::uint64_t zigzag = readVarint(chunk);
+                    previous += (zigzag >> 1) ^ (~(zigzag & 1)+1);
+                    values.push_back(previous);
+                }
+                break;
+            }
+        }
+        return values;
+    }
+};
+
+
+/**
+ * Compact binary result files, either a bitmap of every number or a list of only the happy numbers, with a reader
+ * which maps them into memory
+ *
+ * Happy lists are stored as differences between consecutive happy numbers in the Stream VByte layout (all the 2-bit
+ * length codes of a block first, then the bytes of every difference), which lets SSSE3 decode four differences with
+ * a single shuffle. Blocks of BLOCK_SIZE numbers are listed in an index at the end of the file, so any range can be
+ * read without decoding what comes before it
+ */
+class HnResultFile {
+public:
+    /**
+     * How many happy numbers each block of a happy list holds
+     */
+    static constexpr std::uint64_t BLOCK_SIZE = 4096;
+    static constexpr std::uint32_t VERSION = 1;
+
+    /**
+     * The kinds of result file
+     */
+    enum class Kind {
+        Bitmap,
+        HappyList
+    };
+
+private:
+    struct Header {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t base;
+        std::uint64_t from;
+        std::uint64_t to;
+    };
+
+    struct BlockIndexEntry {
+        std::uint64_t firstValue;
+        std::uint64_t offset;
+        std::uint64_t count;
+    };
+
+    struct Trailer {
+        std::uint64_t indexOffset;
+        std::uint64_t blocks;
+        char magic[4];
+        std::uint32_t version;
+    };
+
+    const std::uint8_t *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    Kind fileKind = Kind::Bitmap;
+    Header header{};
+    /**
+     * The block index, copied out of the mapping since it follows variable-length blocks and so is not aligned
+     */
+    std::vector<BlockIndexEntry> blockIndex;
+    std::uint64_t blockCount = 0;
+    /**
+     * Where the last block ends and the block index starts
+     */
+    std::uint64_t blocksEnd = 0;
+
+public:
+    /**
+     * Walks the happy numbers of a range of a result file in ascending order, decoding a block at a time
+     */
+    class Cursor {
+        const HnResultFile &file;
+        const std::uint64_t to;
+        std::uint64_t position;
+        std::uint64_t block = 0;
+        std::vector<std::uint32_t> decoded;
+        std::size_t decodedIndex = 0;
+        std::uint64_t previous = 0;
+
+    public:
+        Cursor(const HnResultFile &file, const std::uint64_t &from, const std::uint64_t &to)
+                : file(file), to(std::min(to, file.header.to)), position(std::max(from, file.header.from)) {
+            if (file.fileKind == Kind::HappyList) {
+                block = file.findBlock(position);
+                decodedIndex = decoded.size();
+            }
+        }
+
+        /**
+         * Gets the next happy number
+         *
+         * @return The next happy number in the range, or nothing if there are no more
+         */
+        std::optional<std::uint64_t> next() {
+            if (file.fileKind == Kind::Bitmap) {
+                return nextFromBitmap();
+            }
+            while (true) {
+                if (decodedIndex == decoded.size()) {
+                    if (block >= file.blockCount) {
+                        return std::nullopt;
+                    }
+                    decoded = file.decodeBlock(block);
+                    previous = file.blockIndex[block++].firstValue;
+                    decodedIndex = 0;
+                }
+                previous += decoded[decodedIndex++];
+                if (previous > to) {
+                    block = file.blockCount;
+                    decoded.clear();
+                    decodedIndex = 0;
+                    return std::nullopt;
+                } else if (previous >= position) {
+                    return previous;
+                }
+            }
+        }
+
+    private:
+        /**
+         * Finds the next set bit a 64-bit word at a time
+         */
+        std::optional<std::uint64_t> nextFromBitmap() {
+            const std::uint8_t *bits = file.mapping+sizeof(Header);
+            while (position <= to && position >= file.header.from) {
+                const std::uint64_t bit = position-file.header.from;
+                std::uint64_t word = 0;
+                std::memcpy(&word, bits+bit/64*8, std::min<std::uint64_t>(8, file.mappingSize-sizeof(Header)-bit/64*8));
+                word &= ~0ULL << (bit%64);
+                if (word != 0) {
+                    const std::uint64_t found = file.header.from+bit/64*64+__builtin_ctzll(word);
+                    if (found > to) {
+                        break;
+                    }
+                    position = found+1;
+                    return found;
+                }
+                position = file.header.from+(bit/64+1)*64;
+            }
+            position = to+1;
+            return std::nullopt;
+        }
+    };
+
+    /**
+     * Maps a result file into memory
+     *
+     * @param path Where the file was written by writeBitmap or writeHappyList
+     */
+    explicit HnResultFile(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("could not open result file "+path);
+        }
+        struct stat info{};
+        if (fstat(fd, &info) == -1 || static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("result file "+path+" is too small");
+        }
+        mappingSize = info.st_size;
+        void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("could not map result file "+path);
+        }
+        mapping = static_cast<const std::uint8_t*>(address);
+        std::memcpy(&header, mapping, sizeof(header));
+        if (std::memcmp(header.magic, "HNRB", 4) == 0) {
+            fileKind = Kind::Bitmap;
+        } else if (std::memcmp(header.magic, "HNRL", 4) == 0 && mappingSize >= sizeof(Header)+sizeof(Trailer)) {
+            fileKind = Kind::HappyList;
+            Trailer trailer{};
+            std::memcpy(&trailer, mapping+mappingSize-sizeof(Trailer), sizeof(trailer));
+            // The index is followed by 16 bytes of padding, which is the slack for 16-byte loads at the end of a block
+            const std::uint64_t indexEnd = mappingSize-sizeof(Trailer)-16;
+            if (mappingSize < sizeof(Header)+sizeof(Trailer)+16 || trailer.indexOffset < sizeof(Header) || trailer.indexOffset > indexEnd
+                    || trailer.blocks > (indexEnd-trailer.indexOffset)/sizeof(BlockIndexEntry)) {
+                munmap(address, mappingSize);
+                throw std::runtime_error("result file "+path+" has an invalid block index");
+            }
+            blockIndex.resize(trailer.blocks);
+            std::memcpy(blockIndex.data(), mapping+trailer.indexOffset, trailer.blocks*sizeof(BlockIndexEntry));
+            blockCount = trailer.blocks;
+            blocksEnd = trailer.indexOffset;
+            std::uint64_t previousOffset = sizeof(Header);
+            for (std::uint64_t block = 0; block < blockCount; block++) {
+                // Blocks are contiguous, so each one ends where the next one (or the index) starts. A block has a control
+                // byte per group of 4 deltas followed by 1 to 4 bytes per delta, which decodeBlock checks against the controls
+                const BlockIndexEntry &entry = blockIndex[block];
+                const std::uint64_t end = blockEnd(block);
+                const std::uint64_t groups = (entry.count+3)/4;
+                if (entry.count > BLOCK_SIZE || entry.offset < previousOffset || entry.offset > end
+                        || groups+entry.count > end-entry.offset || end-entry.offset > groups+entry.count*4) {
+                    munmap(address, mappingSize);
+                    throw std::runtime_error("result file "+path+" has a block outside of the file");
+                }
+                previousOffset = entry.offset;
+            }
+        } else {
+            munmap(address, mappingSize);
+            throw std::runtime_error("not a result file "+path);
+        }
+        if (header.version != VERSION) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("result file version "+std::to_string(header.version)+" is not supported");
+        } else if (fileKind == Kind::Bitmap && (header.from > header.to || (header.to-header.from)/8+1 > mappingSize-sizeof(Header))) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("result file "+path+" is truncated");
+        }
+    }
+
+    HnResultFile(const HnResultFile&) = delete;
+    HnResultFile &operator=(const HnResultFile&) = delete;
+
+    ~HnResultFile() {
+        munmap(const_cast<std::uint8_t*>(mapping), mappingSize);
+    }
+
+    /**
+     * Gets what kind of result file this is
+     */
+    Kind kind() const {
+        return fileKind;
+    }
+
+    /**
+     * Gets a cursor over the happy numbers in [from, to]
+     */
+    Cursor happyNumbers(const std::uint64_t &from=0, const std::uint64_t &to=UINT64_MAX) const {
+        return {*this, from, to};
+    }
+
+    /**
+     * Calls a function with every happy number in [from, to] in ascending order
+     *
+     * This avoids the per-number overhead of a cursor when every value is wanted
+     */
+    template <typename Callback>
+    void forEachHappy(const std::uint64_t &from, const std::uint64_t &to, Callback onHappy) const {
+        if (fileKind == Kind::Bitmap) {
+            Cursor cursor = happyNumbers(from, to);
+            for (std::optional<std::uint64_t> n = cursor.next(); n; n = cursor.next()) {
+                onHappy(n.value());
+            }
+            return;
+        }
+        for (std::uint64_t block = findBlock(from); block < blockCount; block++) {
+            std::uint64_t value = blockIndex[block].firstValue;
+            if (value > to) {
+                return;
+            }
+            for (const std::uint32_t &delta : decodeBlock(block)) {
+                value += delta;
+                if (value > to) {
+                    return;
+                } else if (value >= from) {
+                    onHappy(value);
+                }
+            }
+        }
+    }
+
+    /**
+     * Writes the happiness of every number in [from, to] as a bitmap, least significant bit first
+     */
+    static void writeBitmap(const HnCalculator &calculator, const std::string &path, const std::uint64_t &from, const std::uint64_t &to) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const Header header{{'H','N','R','B'}, VERSION, static_cast<std::uint64_t>(calculator.base), from, to};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        forEachChunk(calculator, from, to, [&file](const std::uint64_t &chunkFrom, const std::vector<bool> &bitmap) {
+            static_cast<void>(chunkFrom);
+            std::vector<std::uint8_t> bytes((bitmap.size()+7)/8, 0);
+            for (std::size_t i = 0; i < bitmap.size(); i++) {
+                bytes[i/8] |= static_cast<std::uint8_t>(bitmap[i] << (i%8));
+            }
+            file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        });
+        if (!file) {
+            throw std::runtime_error("could not write result file "+path);
+        }
+    }
+
+    /**
+     * Writes the happy numbers in [from, to] as Stream VByte encoded differences with a block index
+     */
+    static void writeHappyList(const HnCalculator &calculator, const std::string &path, const std::uint64_t &from, const std::uint64_t &to) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const Header header{{'H','N','R','L'}, VERSION, static_cast<std::uint64_t>(calculator.base), from, to};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::uint64_t offset = sizeof(header);
+        std::vector<BlockIndexEntry> index;
+        std::vector<std::uint64_t> pending;
+        const auto flush = [&] {
+            if (pending.empty()) {
+                return;
+            }
+            const std::vector<std::uint8_t> block = encodeBlock(pending);
+            index.push_back({pending.front(), offset, pending.size()});
+            file.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block.size()));
+            offset += block.size();
+            pending.clear();
+        };
+        forEachChunk(calculator, from, to, [&](const std::uint64_t &chunkFrom, const std::vector<bool> &bitmap) {
+            for (std::size_t i = 0; i < bitmap.size(); i++) {
+                if (bitmap[i]) {
+                    pending.push_back(chunkFrom+i);
+                    if (pending.size() == BLOCK_SIZE) {
+                        flush();
+                    }
+                }
+            }
+        });
+        flush();
+        const Trailer trailer{offset, index.size(), {'H','N','R','L'}, VERSION};
+        file.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size()*sizeof(BlockIndexEntry)));
+        // Padding so that 16-byte loads at the end of the last block stay within the file
+        const std::uint8_t padding[16] = {};
+        file.write(reinterpret_cast<const char*>(padding), sizeof(padding));
+        file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        if (!file) {
+            throw std::runtime_error("could not write result file "+path);
+        }
+    }
+
+private:
+    /**
+     * Calculates a range with happyBitmap a chunk at a time, so the whole range never needs to be in memory
+     */
+    template <typename Callback>
+    static void forEachChunk(const HnCalculator &calculator, const std::uint64_t &from, const std::uint64_t &to, Callback onChunk) {
+        constexpr std::uint64_t chunkSize = 1 << 24;
+        for (std::uint64_t chunkFrom = from; ; chunkFrom += chunkSize) {
+            const std::uint64_t chunkTo = to-chunkFrom < chunkSize ? to : chunkFrom+chunkSize-1;
+            onChunk(chunkFrom, calculator.happyBitmap(chunkFrom, chunkTo));
+            if (chunkTo == to) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * Finds the first block which may contain numbers at least a given value
+     */
+    std::uint64_t findBlock(const std::uint64_t &value) const {
+        const auto found = std::upper_bound(blockIndex.begin(), blockIndex.end(), value,
+                [](const std::uint64_t &v, const BlockIndexEntry &entry) { return v < entry.firstValue; });
+        return found == blockIndex.begin() ? 0 : found-blockIndex.begin()-1;
+    }
+
+    /**
+     * Encodes ascending values as Stream VByte differences, the first being relative to itself
+     */
+    static std::vector<std::uint8_t> encodeBlock(const std::vector<std::uint64_t> &values) {
+        std::vector<std::uint8_t> controls((values.size()+3)/4, 0);
+        std::vector<std::uint8_t> data;
+        std::uint64_t previous = values.front();
+        for (std::size_t i = 0; i < values.size(); i++) {
+            const std::uint64_t delta = values[i]-previous;
+            if (delta > UINT32_MAX) {
+                throw std::overflow_error("gap between happy numbers does not fit in 32 bits");
+            }
+            const int length = delta < 1 << 8 ? 1 : delta < 1 << 16 ? 2 : delta < 1 << 24 ? 3 : 4;
+            controls[i/4] |= static_cast<std::uint8_t>((length-1) << (i%4*2));
+            for (int byte = 0; byte < length; byte++) {
+                data.push_back(static_cast<std::uint8_t>(delta >> (byte*8)));
+            }
+            previous = values[i];
+        }
+        controls.insert(controls.end(), data.begin(), data.end());
+        return controls;
+    }
+
+    /**
+     * Gets where a block of a happy list ends
+     */
+    std::uint64_t blockEnd(const std::uint64_t &block) const {
+        return block+1 < blockCount ? blockIndex[block+1].offset : blocksEnd;
+    }
+
+    /**
+     * Decodes the differences of a block of a happy list
+     */
+    std::vector<std::uint32_t> decodeBlock(const std::uint64_t &block) const {
+        const std::uint64_t count = blockIndex[block].count;
+        const std::uint8_t *controls = mapping+blockIndex[block].offset;
+        const std::uint8_t *data = controls+(count+3)/4;
+        // The controls say how long the data is, and it must end within the block so 16-byte loads stay within the file
+        std::uint64_t dataLength = 0;
+        for (std::uint64_t i = 0; i < count; i++) {
+            dataLength += ((controls[i/4] >> (i%4*2)) & 3)+1;
+        }
+        if (dataLength > static_cast<std::uint64_t>(mapping+blockEnd(block)-data)) {
+            throw std::runtime_error("result file has a block whose data overruns it");
+        }
+        // Room for a whole final group of 4, which is trimmed afterwards
+        std::vector<std::uint32_t> deltas((count+3)/4*4);
+        static const bool ssse3 = supportsSsse3();
+        if (ssse3) {
+            decodeSsse3(controls, data, deltas.size()/4, deltas.data());
+        } else {
+            decodeScalar(controls, data, deltas.size()/4, deltas.data());
+        }
+        deltas.resize(count);
+        return deltas;
+    }
+
+    /**
+     * Decodes groups of 4 Stream VByte values a byte at a time
+     */
+    static void decodeScalar(const std::uint8_t *controls, const std::uint8_t *data, const std::size_t &groups, std::uint32_t *out) {
+        for (std::size_t group = 0; group < groups; group++) {
+            for (int i = 0; i < 4; i++) {
+                const int length = ((controls[group] >> (i*2)) & 3)+1;
+                std::uint32_t value = 0;
+                for (int byte = 0; byte < length; byte++) {
+                    value |= static_cast<std::uint32_t>(*data++) << (byte*8);
+                }
+                *out++ = value;
+            }
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    static bool supportsSsse3() {
+        return __builtin_cpu_supports("ssse3");
+    }
+
+    /**
+     * Decodes groups of 4 Stream VByte values with one 16-byte shuffle each
+     */
+    __attribute__((target("ssse3")))
+    static void decodeSsse3(const std::uint8_t *controls, const std::uint8_t *data, const std::size_t &groups, std::uint32_t *out) {
+        static const std::array<std::array<std::uint8_t,17>,256> shuffles = [] {
+            // The first 16 bytes are the shuffle mask for each control byte and the last is how much data it covers
+            std::array<std::array<std::uint8_t,17>,256> table{};
+            for (int control = 0; control < 256; control++) {
+                std::uint8_t source = 0;
+                for (int i = 0; i < 4; i++) {
+                    const int length = ((control >> (i*2)) & 3)+1;
+                    for (int byte = 0; byte < 4; byte++) {
+                        table[control][i*4+byte] = byte < length ? source++ : 0x80;
+                    }
+                }
+                table[control][16] = source;
+            }
+            return table;
+        }();
+        for (std::size_t group = 0; group < groups; group++) {
+            const std::array<std::uint8_t,17> &shuffle = shuffles[controls[group]];
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffle.data()));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+group*4), _mm_shuffle_epi8(bytes, mask));
+            data += shuffle[16];
+        }
+    }
+#else
+    static bool supportsSsse3() {
+        return false;
+    }
+
+    static void decodeSsse3(const std::uint8_t *controls, const std::uint8_t *data, const std::size_t &groups, std::uint32_t *out) {
+        decodeScalar(controls, data, groups, out);
+    }
+#endif
+};
+
+
+/**
+ * Happiness of numbers in every base at once, for exports which compare bases
+ */
+class HnMultiBase {
+public:
+    static constexpr std::uint32_t VERSION = 1;
+
+    /**
+     * Determines in which bases each number in a range is happy
+     *
+     * Each base is calculated over the whole range with happyBitmap, so every base uses its own digit kernel and
+     * shared happiness table, and the results are merged into one mask per number
+     *
+     * @param from The first number to calculate
+     * @param to The last number to calculate
+     * @param maxBase The highest base to calculate, at most 63
+     * @param numThreads The number of threads to split the range across
+     * @return For each number in [from, to], a mask with bit b set if the number is happy in base b
+     */
+    static std::vector<std::uint64_t> happyBases(const std::uint64_t &from, const std::uint64_t &to, const char &maxBase,
+                                                 const std::uint16_t numThreads=HnResources::threads()) {
+        if (maxBase < 2 || maxBase > 63) {
+            throw std::invalid_argument("maxBase must be between 2 and 63");
+        }
+        std::vector<std::uint64_t> masks(to-from+1, 0);
+        const std::uint64_t sliceSize = (to-from)/std::max<std::uint16_t>(numThreads, 1)+1;
+        std::vector<std::thread> threads;
+        for (std::uint64_t sliceFrom = from; sliceFrom >= from && sliceFrom <= to; sliceFrom += sliceSize) {
+            const std::uint64_t sliceTo = to-sliceFrom < sliceSize ? to : sliceFrom+sliceSize-1;
+            threads.emplace_back([&masks, from, sliceFrom, sliceTo, maxBase] {
+                for (char base = 2; base <= maxBase; base++) {
+                    const std::vector<bool> bitmap = HnCalculator(false, false, base).happyBitmap(sliceFrom, sliceTo);
+                    for (std::uint64_t i = 0; i < bitmap.size(); i++) {
+                        masks[sliceFrom-from+i] |= static_cast<std::uint64_t>(bitmap[i]) << base;
+                    }
+                }
+            });
+            if (sliceTo == to) {
+                break;
+            }
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        return masks;
+    }
+
+    /**
+     * Writes in which bases each number in a range is happy as a packed column
+     *
+     * After a header of "HNMB", the version, maxBase, from and to, each number has ceil((maxBase-1)/8) bytes in which
+     * bit b-2 (least significant first) is set if the number is happy in base b
+     *
+     * @param path Where to write the column
+     * @param from The first number to write
+     * @param to The last number to write
+     * @param maxBase The highest base to calculate, at most 63
+     */
+    static void writeHappyBases(const std::string &path, const std::uint64_t &from, const std::uint64_t &to, const char &maxBase) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const std::uint32_t version = VERSION;
+        const std::uint64_t header[3] = {static_cast<std::uint64_t>(maxBase), from, to};
+        file.write("HNMB", 4);
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        const std::size_t bytesPerNumber = (maxBase-1+7)/8;
+        constexpr std::uint64_t chunkSize = 1 << 22;
+        for (std::uint64_t chunkFrom = from; ; chunkFrom += chunkSize) {
+            const std::uint64_t chunkTo = to-chunkFrom < chunkSize ? to : chunkFrom+chunkSize-1;
+            const std::vector<std::uint64_t> masks = happyBases(chunkFrom, chunkTo, maxBase);
+            std::vector<std::uint8_t> packed;
+            packed.reserve(masks.size()*bytesPerNumber);
+            for (const std::uint64_t &mask : masks) {
+                for (std::size_t byte = 0; byte < bytesPerNumber; byte++) {
+                    packed.push_back(static_cast<std::uint8_t>(mask >> (2+byte*8)));
+                }
+            }
+            file.write(reinterpret_cast<const char*>(packed.data()), static_cast<std::streamsize>(packed.size()));
+            if (chunkTo == to) {
+                break;
+            }
+        }
+        if (!file) {
+            throw std::runtime_error("could not write multi-base column "+path);
+        }
+    }
+};
+
+
+/**
+ * Searches for the smallest number which is happy in every base from 2 to maxBase
+ *
+ * Candidates are tested one base at a time, most selective base first (as measured by the digit DP), so that most are
+ * rejected after a single sum of digit squares. Bases 2 and 4 are skipped since every positive number is happy in them;
+ * in base 2 the sum of digit squares is just the popcount, which always ends at 1. Other power-of-two bases extract
+ * digits with shifts. Blocks of candidates are claimed by threads in order, and everything below the frontier has
+ * been fully searched, which is what checkpoints record
+ */
+class HnMultiBaseSearch {
+public:
+    /**
+     * The highest base the numbers must be happy in
+     */
+    const char maxBase;
+    /**
+     * How many candidates each thread claims at a time
+     */
+    std::uint64_t blockSize = 1 << 20;
+    /**
+     * If set, the frontier is saved to this file at every checkpoint, and a search resumes from it
+     */
+    std::optional<std::string> checkpointPath;
+    /**
+     * How often to report progress and checkpoint
+     */
+    std::chrono::milliseconds checkpointInterval = std::chrono::seconds(10);
+
+private:
+    /**
+     * A base to test along with its happiness table
+     */
+    struct Filter {
+        char base;
+        int shift;
+        HnTableRegistry::TableRef table;
+    };
+
+    std::vector<Filter> filters;
+    std::mutex searchLock;
+    std::uint64_t nextBlock = 0;
+    std::uint64_t searchFrontier = 0;
+    std::set<std::uint64_t> completedBlocks;
+    std::optional<std::uint64_t> best;
+
+public:
+    explicit HnMultiBaseSearch(const char maxBase) : maxBase(maxBase) {
+        if (maxBase < 2) {
+            throw std::invalid_argument("maxBase must be at least 2");
+        }
+        std::vector<std::pair<double,char>> ranked;
+        for (char base = 3; base <= maxBase; base++) {
+            if (base == 4) {
+                continue;
+            }
+            const HnCalculator calculator(false, false, base);
+            // Happy density below 10^12 (or the closest this base reaches), with cheaper power-of-two bases first on ties
+            const double density = static_cast<double>(calculator.countHappy(1000000000000))/1e12;
+            ranked.emplace_back(density+((base & (base-1)) == 0 ? 0 : 1e-9), base);
+        }
+        std::sort(ranked.begin(), ranked.end());
+        for (const std::pair<double,char> &rank : ranked) {
+            const char base = rank.second;
+            filters.push_back({base, (base & (base-1)) == 0 ? __builtin_ctz(base) : 0,
+                               HnTableRegistry::get(base, HnTablePack::Kind::Happiness)});
+        }
+    }
+
+    /**
+     * Gets the bases in the order they are tested
+     */
+    std::vector<char> filterOrder() const {
+        std::vector<char> bases;
+        for (const Filter &filter : filters) {
+            bases.push_back(filter.base);
+        }
+        return bases;
+    }
+
+    /**
+     * Gets the number below which every candidate has been searched
+     */
+    std::uint64_t frontier() {
+        searchLock.lock();
+        const std::uint64_t value = searchFrontier;
+        searchLock.unlock();
+        return value;
+    }
+
+    /**
+     * Searches for the smallest number in [from, limit] which is happy in every base from 2 to maxBase
+     *
+     * The calling thread reports progress and checkpoints while the search threads run
+     *
+     * @param from The first candidate, defaulting to 2 since 1 is happy in every base
+     * @param limit The last candidate
+     * @param numThreads The number of threads to search with
+     * @return The smallest such number, or nothing if there is none up to limit
+     */
+    std::optional<std::uint64_t> run(std::uint64_t from=2, const std::uint64_t &limit=UINT64_MAX,
+                                     const std::uint16_t numThreads=HnResources::threads()) {
+        if (checkpointPath) {
+            std::ifstream checkpoint(checkpointPath.value());
+            std::uint64_t savedFrontier;
+            if (checkpoint >> savedFrontier) {
+                from = std::max(from, savedFrontier);
+            }
+        }
+        nextBlock = from;
+        searchFrontier = from;
+        completedBlocks.clear();
+        best.reset();
+        const std::uint16_t threadCount = std::max<std::uint16_t>(numThreads, 1);
+        std::atomic<std::uint16_t> running(threadCount);
+        for (std::uint16_t i = 0; i < threadCount; i++) {
+            std::thread([this, limit, &running] {
+                searchBlocks(limit);
+                running--;
+            }).detach();
+        }
+        std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
+        while (running > 0) {
+            std::this_thread::sleep_for(std::min(checkpointInterval, std::chrono::milliseconds(100)));
+            if (std::chrono::steady_clock::now()-lastCheckpoint >= checkpointInterval) {
+                checkpoint();
+                lastCheckpoint = std::chrono::steady_clock::now();
+            }
+        }
+        checkpoint();
+        return best;
+    }
+
+private:
+    /**
+     * Determines whether a number is happy in the base of a filter
+     */
+    static bool passes(const Filter &filter, std::uint64_t n) {
+        std::uint64_t sum = 0;
+        if (filter.shift != 0) {
+            const std::uint64_t mask = (1ULL << filter.shift)-1;
+            for (; n > 0; n >>= filter.shift) {
+                sum += (n & mask)*(n & mask);
+            }
+        } else {
+            for (; n > 0; n /= filter.base) {
+                sum += (n%filter.base)*(n%filter.base);
+            }
+        }
+        return filter.table->data[sum];
+    }
+
+    /**
+     * Claims and searches blocks until the smallest match is known or limit is reached
+     */
+    void searchBlocks(const std::uint64_t &limit) {
+        while (true) {
+            searchLock.lock();
+            const std::uint64_t blockStart = nextBlock;
+            // Blocks past a known match can not contain anything smaller
+            if (blockStart > limit || blockStart < searchFrontier || (best && blockStart > best.value())) {
+                searchLock.unlock();
+                return;
+            }
+            const std::uint64_t blockEnd = limit-blockStart < blockSize ? limit : blockStart+blockSize-1;
+            nextBlock = blockEnd == UINT64_MAX ? 0 : blockEnd+1;
+            searchLock.unlock();
+            HN_PROBE(chunk_start, blockStart, blockEnd);
+            std::optional<std::uint64_t> found;
+            for (std::uint64_t n = blockStart; ; n++) {
+                bool happyInAll = true;
+                for (const Filter &filter : filters) {
+                    if (!passes(filter, n)) {
+                        happyInAll = false;
+                        break;
+                    }
+                }
+                if (happyInAll) {
+                    found = n;
+                    break;
+                } else if (n == blockEnd) {
+                    break;
+                }
+            }
+            HN_PROBE(chunk_end, blockStart, blockEnd);
+            searchLock.lock();
+            if (found && (!best || found.value() < best.value())) {
+                best = found;
+            }
+            completedBlocks.insert(blockStart);
+            while (!completedBlocks.empty() && *completedBlocks.begin() == searchFrontier) {
+                completedBlocks.erase(completedBlocks.begin());
+                const std::uint64_t completedEnd = limit-searchFrontier < blockSize ? limit : searchFrontier+blockSize-1;
+                searchFrontier = completedEnd+1;
+            }
+            searchLock.unlock();
+        }
+    }
+
+    /**
+     * Reports the frontier and saves it to checkpointPath if set
+     */
+    void checkpoint() {
+        searchLock.lock();
+        const std::uint64_t currentFrontier = best ? std::min(best.value(), searchFrontier) : searchFrontier;
+        const std::optional<std::uint64_t> currentBest = best;
+        searchLock.unlock();
+        std::stringstream msg;
+        msg << "Searched up to " << currentFrontier;
+        if (currentBest) {
+            msg << ", smallest found so far " << currentBest.value();
+        }
+        msg << std::endl;
+        std::cout << msg.str();
+        if (checkpointPath) {
+            std::ofstream(checkpointPath.value(), std::ios::trunc) << currentFrontier << std::endl;
+        }
+        HN_PROBE(checkpoint, currentFrontier);
+    }
+};
+
+
+/**
+ * A bitmap of the happiness of a huge range, of which only the pages that are actually queried are ever calculated
+ *
+ * The whole bitmap is reserved as virtual memory and registered with userfaultfd, so the first read of each page
+ * faults to a handler thread which fills it using happyBitmap. After that, lookups are a single bit test. Where
+ * userfaultfd is not permitted, lookups check and fill pages themselves instead. Calculated pages can be saved and
+ * loaded again so they never need calculating twice
+ */
+class HnLazyBitmap {
+public:
+    const std::uint64_t from;
+    const std::uint64_t to;
+
+private:
+    const HnCalculator calculator;
+    const std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t mappingSize = 0;
+    std::uint8_t *mapping = nullptr;
+    int faultFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread faultHandler;
+    std::unique_ptr<std::atomic<bool>[]> pageReady;
+    std::mutex fillLock;
+
+public:
+    /**
+     * Reserves a bitmap covering [from, to] without calculating any of it
+     *
+     * @param from The first number of the range
+     * @param to The last number of the range
+     * @param base The base to calculate happiness in
+     */
+    HnLazyBitmap(const std::uint64_t &from, const std::uint64_t &to, const char base=10)
+            : from(from), to(to), calculator(false, false, base) {
+        mappingSize = ((to-from)/8/pageSize+1)*pageSize;
+        void *address = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("could not reserve a lazy bitmap of "+std::to_string(mappingSize)+" bytes");
+        }
+        mapping = static_cast<std::uint8_t*>(address);
+        pageReady.reset(new std::atomic<bool>[mappingSize/pageSize]());
+        faultFd = static_cast<int>(syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+        if (faultFd != -1) {
+            uffdio_api api{};
+            api.api = UFFD_API;
+            uffdio_register registration{};
+            registration.range.start = reinterpret_cast<std::uint64_t>(mapping);
+            registration.range.len = mappingSize;
+            registration.mode = UFFDIO_REGISTER_MODE_MISSING;
+            if (ioctl(faultFd, UFFDIO_API, &api) == -1 || ioctl(faultFd, UFFDIO_REGISTER, &registration) == -1) {
+                close(faultFd);
+                faultFd = -1;
+            } else {
+                faultHandler = std::thread(&HnLazyBitmap::handleFaults, this);
+            }
+        }
+    }
+
+    HnLazyBitmap(const HnLazyBitmap&) = delete;
+    HnLazyBitmap &operator=(const HnLazyBitmap&) = delete;
+
+    ~HnLazyBitmap() {
+        stopping = true;
+        if (faultHandler.joinable()) {
+            faultHandler.join();
+        }
+        if (faultFd != -1) {
+            close(faultFd);
+        }
+        munmap(mapping, mappingSize);
+    }
+
+    /**
+     * Determines if a number in the range is happy, calculating its page first if nothing has touched it yet
+     *
+     * @param n The number which must be looked up
+     * @return Whether n is happy
+     */
+    bool isHappy(const std::uint64_t &n) {
+        if (n < from || n > to) {
+            throw std::out_of_range("number is outside of the lazy bitmap");
+        }
+        const std::uint64_t bit = n-from;
+        if (faultFd == -1 && !pageReady[bit/8/pageSize].load(std::memory_order_acquire)) {
+            fillLock.lock();
+            if (!pageReady[bit/8/pageSize]) {
+                calculatePage(bit/8/pageSize, mapping+bit/8/pageSize*pageSize);
+                pageReady[bit/8/pageSize].store(true, std::memory_order_release);
+            }
+            fillLock.unlock();
+        }
+        return (mapping[bit/8] >> (bit%8)) & 1;
+    }
+
+    /**
+     * Gets whether pages are being filled by userfaultfd rather than by lookups
+     */
+    bool usesUserfaultfd() const {
+        return faultFd != -1;
+    }
+
+    /**
+     * Counts how many pages have been calculated so far
+     */
+    std::uint64_t calculatedPages() const {
+        std::uint64_t count = 0;
+        for (std::size_t page = 0; page < mappingSize/pageSize; page++) {
+            count += pageReady[page];
+        }
+        return count;
+    }
+
+    /**
+     * Saves every calculated page, each preceded by its index
+     *
+     * @param path Where to save the pages
+     */
+    void save(const std::string &path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const std::uint64_t header[3] = {from, to, static_cast<std::uint64_t>(calculator.base)};
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (std::uint64_t page = 0; page < mappingSize/pageSize; page++) {
+            if (pageReady[page]) {
+                file.write(reinterpret_cast<const char*>(&page), sizeof(page));
+                file.write(reinterpret_cast<const char*>(mapping+page*pageSize), static_cast<std::streamsize>(pageSize));
+            }
+        }
+        if (!file) {
+            throw std::runtime_error("could not save lazy bitmap "+path);
+        }
+    }
+
+    /**
+     * Loads pages saved from a lazy bitmap of the same range and base, so they do not need calculating
+     *
+     * @param path Where the pages were saved
+     */
+    void load(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        std::uint64_t header[3];
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != from || header[1] != to
+                || header[2] != static_cast<std::uint64_t>(calculator.base)) {
+            throw std::runtime_error("saved lazy bitmap "+path+" does not match this range");
+        }
+        std::vector<std::uint8_t> contents(pageSize);
+        std::uint64_t page;
+        while (file.read(reinterpret_cast<char*>(&page), sizeof(page))
+                && file.read(reinterpret_cast<char*>(contents.data()), static_cast<std::streamsize>(pageSize))) {
+            if (page < mappingSize/pageSize) {
+                fillLock.lock();
+                if (!pageReady[page]) {
+                    installPage(page, contents.data());
+                }
+                fillLock.unlock();
+            }
+        }
+    }
+
+private:
+    /**
+     * Calculates the bits of a page
+     */
+    void calculatePage(const std::uint64_t &page, std::uint8_t *contents) const {
+        std::memset(contents, 0, pageSize);
+        const std::uint64_t pageFrom = from+page*pageSize*8;
+        if (pageFrom > to || pageFrom < from) {
+            return;
+        }
+        const std::uint64_t pageTo = to-pageFrom < pageSize*8 ? to : pageFrom+pageSize*8-1;
+        const std::vector<bool> bitmap = calculator.happyBitmap(pageFrom, pageTo);
+        for (std::size_t i = 0; i < bitmap.size(); i++) {
+            contents[i/8] |= static_cast<std::uint8_t>(bitmap[i] << (i%8));
+        }
+    }
+
+    /**
+     * Puts the contents of a page into the mapping, which must be done atomically while userfaultfd is watching it
+     */
+    void installPage(const std::uint64_t &page, const std::uint8_t *contents) {
+        if (faultFd == -1) {
+            std::memcpy(mapping+page*pageSize, contents, pageSize);
+        } else {
+            uffdio_copy copy{};
+            copy.dst = reinterpret_cast<std::uint64_t>(mapping+page*pageSize);
+            copy.src = reinterpret_cast<std::uint64_t>(contents);
+            copy.len = pageSize;
+            // EEXIST means the page was installed in the meantime, which is just as good
+            if (ioctl(faultFd, UFFDIO_COPY, &copy) == -1 && errno != EEXIST) {
+                throw std::runtime_error("could not install lazy bitmap page");
+            }
+        }
+        pageReady[page].store(true, std::memory_order_release);
+    }
+
+    /**
+     * Fills pages as they are faulted on, until the bitmap is destroyed
+     */
+    void handleFaults() {
+        std::vector<std::uint8_t> contents(pageSize);
+        while (!stopping) {
+            pollfd descriptor{faultFd, POLLIN, 0};
+            if (poll(&descriptor, 1, 100) <= 0) {
+                continue;
+            }
+            uffd_msg message{};
+            if (read(faultFd, &message, sizeof(message)) != sizeof(message) || message.event != UFFD_EVENT_PAGEFAULT) {
+                continue;
+            }
+            const std::uint64_t page = (message.arg.pagefault.address-reinterpret_cast<std::uint64_t>(mapping))/pageSize;
+            HN_PROBE(page_fault, page);
+            calculatePage(page, contents.data());
+            fillLock.lock();
+            installPage(page, contents.data());
+            fillLock.unlock();
+        }
+    }
+};
+
+/**
+ * A persistent store of happiness for scattered ranges which have been calculated over time
+ *
+ * Which numbers are covered is kept as a map of disjoint intervals, merged whenever they touch, and the results as
+ * bitmaps in fixed-size segments so that only the parts of the number line which have been calculated take space.
+ * Asking for a range only calculates the gaps in it which are not covered yet
+ */
+class HnCoverageStore {
+public:
+    /**
+     * How many numbers each segment bitmap covers
+     */
+    static constexpr std::uint64_t SEGMENT_SIZE = 1 << 20;
+    static constexpr std::uint32_t VERSION = 1;
+
+    const std::string path;
+    const char base;
+
+private:
+    /**
+     * The first number of each covered interval mapped to its last
+     */
+    std::map<std::uint64_t,std::uint64_t> coverage;
+    std::map<std::uint64_t,std::vector<std::uint8_t>> segments;
+    mutable std::mutex storeLock;
+
+public:
+    /**
+     * Opens a store, loading it from path if it has been saved before
+     *
+     * @param path Where the store is saved
+     * @param base The base happiness is calculated in, which must match the saved store
+     */
+    explicit HnCoverageStore(const std::string &path, const char base=10) : path(path), base(base) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return;
+        }
+        char magic[4];
+        std::uint32_t version = 0;
+        std::uint64_t savedBase = 0, intervals = 0, segmentCount = 0;
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        file.read(reinterpret_cast<char*>(&savedBase), sizeof(savedBase));
+        if (!file || std::memcmp(magic, "HNCS", 4) != 0 || version != VERSION) {
+            throw std::runtime_error("not a coverage store "+path);
+        } else if (savedBase != static_cast<std::uint64_t>(base)) {
+            throw std::runtime_error("coverage store "+path+" is for base "+std::to_string(savedBase));
+        }
+        file.read(reinterpret_cast<char*>(&intervals), sizeof(intervals));
+        for (std::uint64_t i = 0; i < intervals && file; i++) {
+            std::uint64_t interval[2];
+            file.read(reinterpret_cast<char*>(interval), sizeof(interval));
+            coverage[interval[0]] = interval[1];
+        }
+        file.read(reinterpret_cast<char*>(&segmentCount), sizeof(segmentCount));
+        for (std::uint64_t i = 0; i < segmentCount && file; i++) {
+            std::uint64_t segment = 0;
+            file.read(reinterpret_cast<char*>(&segment), sizeof(segment));
+            std::vector<std::uint8_t> &bits = segments[segment];
+            bits.resize(SEGMENT_SIZE/8);
+            file.read(reinterpret_cast<char*>(bits.data()), static_cast<std::streamsize>(bits.size()));
+        }
+        if (!file) {
+            throw std::runtime_error("coverage store "+path+" is truncated");
+        }
+    }
+
+    /**
+     * Finds the parts of a range which are not covered yet
+     *
+     * @param from The first number of the range
+     * @param to The last number of the range
+     * @return The uncovered [from, to] intervals in ascending order
+     */
+    std::vector<std::pair<std::uint64_t,std::uint64_t>> gaps(const std::uint64_t &from, const std::uint64_t &to) const {
+        std::vector<std::pair<std::uint64_t,std::uint64_t>> found;
+        storeLock.lock();
+        std::uint64_t position = from;
+        bool finished = false;
+        auto interval = coverage.upper_bound(from);
+        if (interval != coverage.begin()) {
+            interval--;
+        }
+        for (; interval != coverage.end() && interval->first <= to && !finished; interval++) {
+            if (interval->second < position) {
+                continue;
+            } else if (interval->first > position) {
+                found.emplace_back(position, interval->first-1);
+            }
+            finished = interval->second >= to;
+            position = interval->second+1;
+        }
+        if (!finished) {
+            found.emplace_back(position, to);
+        }
+        storeLock.unlock();
+        return found;
+    }
+
+    /**
+     * Makes sure a range is covered, calculating only the gaps in it
+     *
+     * @param calculator The calculator to fill the gaps with, which must use the same base as the store
+     * @param from The first number of the range
+     * @param to The last number of the range
+     * @return How many numbers had to be calculated
+     */
+    std::uint64_t cover(const HnCalculator &calculator, const std::uint64_t &from, const std::uint64_t &to) {
+        if (calculator.base != base) {
+            throw std::invalid_argument("calculator base does not match the coverage store");
+        }
+        std::uint64_t calculated = 0;
+        for (const std::pair<std::uint64_t,std::uint64_t> &gap : gaps(from, to)) {
+            // Calculated a segment at a time, so each piece is recorded as soon as it is done
+            for (std::uint64_t pieceFrom = gap.first; ; ) {
+                const std::uint64_t segmentEnd = pieceFrom/SEGMENT_SIZE*SEGMENT_SIZE+(SEGMENT_SIZE-1);
+                const std::uint64_t pieceTo = std::min(gap.second, segmentEnd);
+                const std::vector<bool> bitmap = calculator.happyBitmap(pieceFrom, pieceTo);
+                storeLock.lock();
+                std::vector<std::uint8_t> &bits = segments[pieceFrom/SEGMENT_SIZE];
+                bits.resize(SEGMENT_SIZE/8);
+                for (std::uint64_t i = 0, bit = pieceFrom%SEGMENT_SIZE; i < bitmap.size(); i++, bit++) {
+                    bits[bit/8] |= static_cast<std::uint8_t>(bitmap[i] << (bit%8));
+                }
+                addCoverage(pieceFrom, pieceTo);
+                storeLock.unlock();
+                calculated += bitmap.size();
+                if (pieceTo == gap.second) {
+                    break;
+                }
+                pieceFrom = pieceTo+1;
+            }
+        }
+        return calculated;
+    }
+
+    /**
+     * Looks up whether a number is happy
+     *
+     * @param n The number which must be looked up
+     * @return Whether n is happy, or nothing if n is not covered
+     */
+    std::optional<bool> isHappy(const std::uint64_t &n) const {
+        storeLock.lock();
+        auto interval = coverage.upper_bound(n);
+        std::optional<bool> happy;
+        if (interval != coverage.begin() && (--interval)->second >= n) {
+            happy = (segments.at(n/SEGMENT_SIZE)[n%SEGMENT_SIZE/8] >> (n%8)) & 1;
+        }
+        storeLock.unlock();
+        return happy;
+    }
+
+    /**
+     * Gets the covered intervals
+     *
+     * @return Every covered [from, to] interval in ascending order, with touching intervals merged
+     */
+    std::vector<std::pair<std::uint64_t,std::uint64_t>> covered() const {
+        storeLock.lock();
+        const std::vector<std::pair<std::uint64_t,std::uint64_t>> intervals(coverage.begin(), coverage.end());
+        storeLock.unlock();
+        return intervals;
+    }
+
+    /**
+     * Saves the coverage and every segment to path, replacing it only once the new store is fully written
+     */
+    void save() const {
+        const std::string temporaryPath = path+".tmp";
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        storeLock.lock();
+        const std::uint64_t savedBase = base, intervals = coverage.size(), segmentCount = segments.size();
+        file.write("HNCS", 4);
+        file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+        file.write(reinterpret_cast<const char*>(&savedBase), sizeof(savedBase));
+        file.write(reinterpret_cast<const char*>(&intervals), sizeof(intervals));
+        for (const std::pair<const std::uint64_t,std::uint64_t> &interval : coverage) {
+            const std::uint64_t bounds[2] = {interval.first, interval.second};
+            file.write(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+        }
+        file.write(reinterpret_cast<const char*>(&segmentCount), sizeof(segmentCount));
+        for (const std::pair<const std::uint64_t,std::vector<std::uint8_t>> &segment : segments) {
+            file.write(reinterpret_cast<const char*>(&segment.first), sizeof(segment.first));
+            file.write(reinterpret_cast<const char*>(segment.second.data()), static_cast<std::streamsize>(segment.second.size()));
+        }
+        storeLock.unlock();
+        file.close();
+        if (!file || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("could not save coverage store "+path);
+        }
+    }
+
+private:
+    /**
+     * Marks an interval as covered, merging it with any intervals it overlaps or touches
+     *
+     * This must be called with storeLock held
+     */
+    void addCoverage(std::uint64_t from, std::uint64_t to) {
+        auto interval = coverage.upper_bound(from);
+        if (interval != coverage.begin()) {
+            auto previous = std::prev(interval);
+            if (previous->second == UINT64_MAX || previous->second+1 >= from) {
+                from = previous->first;
+                to = std::max(to, previous->second);
+                interval = coverage.erase(previous);
+            }
+        }
+        while (interval != coverage.end() && (to == UINT64_MAX || interval->first <= to+1)) {
+            to = std::max(to, interval->second);
+            interval = coverage.erase(interval);
+        }
+        coverage[from] = to;
+    }
+};
+
+/**
+ * A file of results split into independently compressed blocks, so that blocks can be produced and compressed by many
+ * threads at once, pigz-style, and decompressed in parallel or one at a time for random access
+ *
+ * Blocks are compressed with a small built-in LZ77 compressor in the style of LZ4, which is fast enough to keep up with
+ * happyBitmap, and are followed by an index of where each block's raw bytes start
+ */
+class HnCompressedStream {
+public:
+    static constexpr std::uint32_t VERSION = 1;
+
+    /**
+     * What the raw bytes of a stream hold
+     */
+    enum class Format : std::uint32_t {
+        Raw,
+        /**
+         * A line for every number, in the same form as newResult outputs
+         */
+        Text,
+        /**
+         * A bit for every number, least significant bit first
+         */
+        Bitmap
+    };
+
+private:
+    static constexpr std::uint64_t TEXT_BLOCK_NUMBERS = 1 << 16;
+    static constexpr std::uint64_t BITMAP_BLOCK_NUMBERS = 1 << 23;
+    static constexpr std::size_t MIN_MATCH = 4;
+
+    struct Header {
+        char magic[4];
+        std::uint32_t version;
+        Format format;
+        std::uint32_t reserved;
+        std::uint64_t base;
+        std::uint64_t from;
+        std::uint64_t to;
+    };
+
+    struct BlockIndexEntry {
+        std::uint64_t rawOffset;
+        std::uint64_t rawSize;
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint64_t checksum;
+    };
+
+    struct Trailer {
+        std::uint64_t indexOffset;
+        std::uint64_t blocks;
+        char magic[4];
+        std::uint32_t version;
+    };
+
+    /**
+     * A block which has been produced and compressed, waiting to be written in order
+     */
+    struct CompressedBlock {
+        std::uint64_t rawSize;
+        std::uint64_t checksum;
+        std::vector<std::uint8_t> data;
+    };
+
+    const std::uint8_t *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    Header header{};
+    /**
+     * The block index, copied out of the mapping since it follows variable-length blocks and so is not aligned
+     */
+    std::vector<BlockIndexEntry> blockIndex;
+    std::uint64_t blockCount = 0;
+
+public:
+    /**
+     * Maps a compressed stream into memory
+     *
+     * @param path Where the stream was written
+     */
+    explicit HnCompressedStream(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("could not open compressed stream "+path);
+        }
+        struct stat info{};
+        if (fstat(fd, &info) == -1 || static_cast<std::size_t>(info.st_size) < sizeof(Header)+sizeof(Trailer)) {
+            close(fd);
+            throw std::runtime_error("compressed stream "+path+" is too small");
+        }
+        mappingSize = info.st_size;
+        void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("could not map compressed stream "+path);
+        }
+        mapping = static_cast<const std::uint8_t*>(address);
+        std::memcpy(&header, mapping, sizeof(header));
+        Trailer trailer{};
+        std::memcpy(&trailer, mapping+mappingSize-sizeof(Trailer), sizeof(trailer));
+        if (std::memcmp(header.magic, "HNCZ", 4) != 0 || std::memcmp(trailer.magic, "HNCZ", 4) != 0
+                || trailer.indexOffset < sizeof(Header) || trailer.indexOffset > mappingSize-sizeof(Trailer)
+                || trailer.blocks > (mappingSize-sizeof(Trailer)-trailer.indexOffset)/sizeof(BlockIndexEntry)) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("not a complete compressed stream "+path);
+        } else if (header.version != VERSION) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("compressed stream version "+std::to_string(header.version)+" is not supported");
+        }
+        blockIndex.resize(trailer.blocks);
+        std::memcpy(blockIndex.data(), mapping+trailer.indexOffset, trailer.blocks*sizeof(BlockIndexEntry));
+        blockCount = trailer.blocks;
+        // Blocks must follow on from each other, since readAll decompresses each straight to its raw offset
+        std::uint64_t rawOffset = 0;
+        for (const BlockIndexEntry &entry : blockIndex) {
+            if (entry.rawOffset != rawOffset || entry.offset > trailer.indexOffset || entry.size > trailer.indexOffset-entry.offset) {
+                munmap(address, mappingSize);
+                throw std::runtime_error("compressed stream "+path+" has an invalid block index");
+            }
+            rawOffset += entry.rawSize;
+        }
+    }
+
+    HnCompressedStream(const HnCompressedStream&) = delete;
+    HnCompressedStream &operator=(const HnCompressedStream&) = delete;
+
+    ~HnCompressedStream() {
+        munmap(const_cast<std::uint8_t*>(mapping), mappingSize);
+    }
+
+    /**
+     * Gets what the raw bytes of this stream hold
+     */
+    Format format() const {
+        return header.format;
+    }
+
+    /**
+     * Gets how many raw bytes the stream holds once decompressed
+     */
+    std::uint64_t rawSize() const {
+        return blockCount == 0 ? 0 : blockIndex[blockCount-1].rawOffset+blockIndex[blockCount-1].rawSize;
+    }
+
+    /**
+     * Gets how many compressed blocks the stream holds
+     */
+    std::uint64_t blocks() const {
+        return blockCount;
+    }
+
+    /**
+     * Decompresses a single block
+     *
+     * @param block The index of the block
+     * @return The raw bytes of the block
+     */
+    std::vector<std::uint8_t> readBlock(const std::uint64_t &block) const {
+        if (block >= blockCount) {
+            throw std::out_of_range("block is not in the compressed stream");
+        }
+        std::vector<std::uint8_t> raw(blockIndex[block].rawSize);
+        decompressBlock(block, raw.data());
+        return raw;
+    }
+
+    /**
+     * Decompresses part of the stream, only touching the blocks which overlap it
+     *
+     * @param rawOffset Where in the raw bytes to start
+     * @param length How many raw bytes to read, which is cut short at the end of the stream
+     * @return The raw bytes
+     */
+    std::vector<std::uint8_t> read(const std::uint64_t &rawOffset, std::uint64_t length) const {
+        const std::uint64_t size = rawSize();
+        if (rawOffset >= size) {
+            return {};
+        }
+        length = std::min(length, size-rawOffset);
+        std::vector<std::uint8_t> raw(length);
+        auto entry = std::upper_bound(blockIndex.begin(), blockIndex.end(), rawOffset,
+                [](const std::uint64_t &value, const BlockIndexEntry &e) { return value < e.rawOffset; })-1;
+        for (; entry != blockIndex.end() && entry->rawOffset < rawOffset+length; entry++) {
+            const std::vector<std::uint8_t> block = readBlock(entry-blockIndex.begin());
+            const std::uint64_t start = std::max(rawOffset, entry->rawOffset);
+            const std::uint64_t end = std::min(rawOffset+length, entry->rawOffset+entry->rawSize);
+            std::memcpy(raw.data()+(start-rawOffset), block.data()+(start-entry->rawOffset), end-start);
+        }
+        return raw;
+    }
+
+    /**
+     * Decompresses the whole stream, with threads taking blocks in turn
+     *
+     * @param numThreads How many threads to decompress with
+     * @return The raw bytes
+     */
+    std::vector<std::uint8_t> readAll(const std::uint16_t numThreads=HnResources::threads()) const {
+        std::vector<std::uint8_t> raw(rawSize());
+        std::atomic<std::uint64_t> nextBlock{0};
+        std::vector<std::thread> threads;
+        std::exception_ptr failure;
+        std::mutex failureLock;
+        for (std::uint16_t i = 0; i < std::max<std::uint16_t>(numThreads, 1); i++) {
+            threads.emplace_back([&] {
+                try {
+                    for (std::uint64_t block = nextBlock++; block < blockCount; block = nextBlock++) {
+                        decompressBlock(block, raw.data()+blockIndex[block].rawOffset);
+                    }
+                } catch (...) {
+                    failureLock.lock();
+                    failure = std::current_exception();
+                    failureLock.unlock();
+                }
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        return raw;
+    }
+
+    /**
+     * Looks up a number in a bitmap stream, decompressing only the block it is in
+     *
+     * @param n The number which must be looked up
+     * @return Whether n is happy
+     */
+    bool isHappy(const std::uint64_t &n) const {
+        if (header.format != Format::Bitmap || n < header.from || n > header.to) {
+            throw std::out_of_range("number is not in this bitmap stream");
+        }
+        return (read((n-header.from)/8, 1)[0] >> ((n-header.from)%8)) & 1;
+    }
+
+    /**
+     * Writes the results for [from, to] as text or a bitmap, with threads each calculating, formatting and compressing
+     * a block at a time
+     *
+     * @param calculator The calculator to calculate the results with
+     * @param path Where to write the stream
+     * @param from The first number of the range
+     * @param to The last number of the range
+     * @param format Whether to write text or a bitmap
+     * @param numThreads How many blocks to produce at once
+     */
+    static void writeResults(const HnCalculator &calculator, const std::string &path, const std::uint64_t &from,
+                             const std::uint64_t &to, const Format &format, const std::uint16_t numThreads=HnResources::threads()) {
+        if (format == Format::Raw) {
+            throw std::invalid_argument("results must be written as text or a bitmap");
+        }
+        const std::uint64_t blockNumbers = format == Format::Text ? TEXT_BLOCK_NUMBERS : BITMAP_BLOCK_NUMBERS;
+        const std::uint64_t blocks = (to-from)/blockNumbers+1;
+        const Header header{{'H','N','C','Z'}, VERSION, format, 0, static_cast<std::uint64_t>(calculator.base), from, to};
+        write(path, header, blocks, numThreads, [&](const std::uint64_t &block) {
+            const std::uint64_t blockFrom = from+block*blockNumbers;
+            const std::uint64_t blockTo = to-blockFrom < blockNumbers ? to : blockFrom+blockNumbers-1;
+            const std::vector<bool> bitmap = calculator.happyBitmap(blockFrom, blockTo);
+            std::vector<std::uint8_t> raw;
+            if (format == Format::Bitmap) {
+                raw.resize((bitmap.size()+7)/8);
+                for (std::size_t i = 0; i < bitmap.size(); i++) {
+                    raw[i/8] |= static_cast<std::uint8_t>(bitmap[i] << (i%8));
+                }
+            } else {
+                raw.reserve(bitmap.size()*20);
+                for (std::size_t i = 0; i < bitmap.size(); i++) {
+                    const std::string line = std::to_string(blockFrom+i)+(bitmap[i] ? " is happy\n" : " is not happy\n");
+                    raw.insert(raw.end(), line.begin(), line.end());
+                }
+            }
+            return raw;
+        });
+    }
+
+    /**
+     * Writes any bytes as a compressed stream
+     *
+     * @param path Where to write the stream
+     * @param data The bytes to write
+     * @param blockSize How many raw bytes each block holds
+     * @param numThreads How many blocks to compress at once
+     */
+    static void writeRaw(const std::string &path, const std::vector<std::uint8_t> &data, const std::uint64_t &blockSize=1 << 20,
+                         const std::uint16_t numThreads=HnResources::threads()) {
+        const Header header{{'H','N','C','Z'}, VERSION, Format::Raw, 0, 0, 0, 0};
+        write(path, header, (data.size()+blockSize-1)/blockSize, numThreads, [&](const std::uint64_t &block) {
+            const std::uint64_t start = block*blockSize;
+            const std::uint64_t end = std::min<std::uint64_t>(start+blockSize, data.size());
+            return std::vector<std::uint8_t>(data.begin()+start, data.begin()+end);
+        });
+    }
+
+    /**
+     * Compresses bytes with the built-in LZ77 compressor
+     *
+     * Each sequence is a token holding how many literals follow and how long the match after them is, the literals, and
+     * the distance back to the match. Lengths which do not fit in the token's four bits continue in following bytes
+     *
+     * @param raw The bytes to compress
+     * @return The compressed bytes
+     */
+    static std::vector<std::uint8_t> compress(const std::vector<std::uint8_t> &raw) {
+        std::vector<std::uint8_t> out;
+        out.reserve(raw.size()/2+16);
+        std::vector<std::uint32_t> table(1 << 16, UINT32_MAX);
+        const auto load = [&raw](const std::size_t &at) {
+            std::uint32_t value;
+            std::memcpy(&value, raw.data()+at, sizeof(value));
+            return value;
+        };
+        const auto appendLength = [&out](std::size_t length) {
+            for (; length >= 255; length -= 255) {
+                out.push_back(255);
+            }
+            out.push_back(static_cast<std::uint8_t>(length));
+        };
+        const auto emit = [&](const std::size_t &literalStart, const std::size_t &literals, const std::size_t &distance, const std::size_t &matchLength) {
+            const std::size_t extraMatch = matchLength == 0 ? 0 : matchLength-MIN_MATCH;
+            out.push_back(static_cast<std::uint8_t>(std::min<std::size_t>(literals, 15) << 4 | std::min<std::size_t>(extraMatch, 15)));
+            if (literals >= 15) {
+                appendLength(literals-15);
+            }
+            out.insert(out.end(), raw.begin()+static_cast<std::ptrdiff_t>(literalStart), raw.begin()+static_cast<std::ptrdiff_t>(literalStart+literals));
+            if (matchLength != 0) {
+                out.push_back(static_cast<std::uint8_t>(distance));
+                out.push_back(static_cast<std::uint8_t>(distance >> 8));
+                if (extraMatch >= 15) {
+                    appendLength(extraMatch-15);
+                }
+            }
+        };
+        std::size_t anchor = 0;
+        for (std::size_t i = 0; i+MIN_MATCH <= raw.size(); ) {
+            const std::uint32_t value = load(i);
+            const std::uint32_t hash = (value*2654435761U) >> 16;
+            const std::uint32_t candidate = table[hash];
+            table[hash] = static_cast<std::uint32_t>(i);
+            if (candidate != UINT32_MAX && i-candidate <= 0xffff && load(candidate) == value) {
+                std::size_t length = MIN_MATCH;
+                while (i+length < raw.size() && raw[candidate+length] == raw[i+length]) {
+                    length++;
+                }
+                emit(anchor, i-anchor, i-candidate, length);
+                i += length;
+                anchor = i;
+            } else {
+                // Step further the longer nothing has matched, so incompressible data is skipped over quickly
+                i += 1+((i-anchor) >> 6);
+            }
+        }
+        emit(anchor, raw.size()-anchor, 0, 0);
+        return out;
+    }
+
+    /**
+     * Decompresses bytes compressed by compress
+     *
+     * @param data The compressed bytes
+     * @param size How many compressed bytes there are
+     * @param out Where to write the raw bytes
+     * @param rawSize How many raw bytes there must be
+     */
+    static void decompress(const std::uint8_t *data, const std::size_t &size, std::uint8_t *out, const std::size_t &rawSize) {
+        const std::uint8_t *end = data+size;
+        std::size_t written = 0;
+        const auto readLength = [&](std::size_t length) {
+            if (length == 15) {
+                std::uint8_t byte;
+                do {
+                    if (data == end) {
+                        throw std::runtime_error("compressed block is truncated");
+                    }
+                    length += byte = *data++;
+                } while (byte == 255);
+            }
+            return length;
+        };
+        while (data < end) {
+            const std::uint8_t token = *data++;
+            const std::size_t literals = readLength(token >> 4);
+            if (literals > static_cast<std::size_t>(end-data) || literals > rawSize-written) {
+                throw std::runtime_error("compressed block is corrupt");
+            }
+            std::memcpy(out+written, data, literals);
+            data += literals;
+            written += literals;
+            if (data == end) {
+                break;
+            } else if (end-data < 2) {
+                throw std::runtime_error("compressed block is truncated");
+            }
+            const std::size_t distance = data[0] | data[1] << 8;
+            data += 2;
+            const std::size_t length = readLength(token & 15)+MIN_MATCH;
+            if (distance == 0 || distance > written || length > rawSize-written) {
+                throw std::runtime_error("compressed block is corrupt");
+            }
+            // Copied a byte at a time since a match may overlap the bytes it is producing
+            for (std::size_t i = 0; i < length; i++, written++) {
+                out[written] = out[written-distance];
+            }
+        }
+        if (written != rawSize) {
+            throw std::runtime_error("compressed block is truncated");
+        }
+    }
+
+private:
+    /**
+     * Produces and compresses blocks in batches of numThreads, writing each batch in order while the next is compressed
+     */
+    template <typename MakeBlock>
+    static void write(const std::string &path, const Header &header, const std::uint64_t &blocks,
+                      const std::uint16_t &numThreads, MakeBlock makeBlock) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::uint64_t offset = sizeof(header);
+        std::uint64_t rawOffset = 0;
+        std::vector<BlockIndexEntry> index;
+        const std::uint64_t batchSize = std::max<std::uint16_t>(numThreads, 1);
+        std::vector<CompressedBlock> current, previous;
+        const auto writeBatch = [&](const std::vector<CompressedBlock> &batch) {
+            for (const CompressedBlock &block : batch) {
+                index.push_back({rawOffset, block.rawSize, offset, block.data.size(), block.checksum});
+                file.write(reinterpret_cast<const char*>(block.data.data()), static_cast<std::streamsize>(block.data.size()));
+                rawOffset += block.rawSize;
+                offset += block.data.size();
+            }
+        };
+        for (std::uint64_t batchStart = 0; batchStart < blocks; batchStart += batchSize) {
+            current.assign(std::min(batchSize, blocks-batchStart), {});
+            std::vector<std::thread> threads;
+            for (std::uint64_t i = 0; i < current.size(); i++) {
+                threads.emplace_back([&current, &makeBlock, i, batchStart] {
+                    const std::vector<std::uint8_t> raw = makeBlock(batchStart+i);
+                    current[i] = {raw.size(), fnv1a(raw.data(), raw.size()), compress(raw)};
+                });
+            }
+            writeBatch(previous);
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+            std::swap(current, previous);
+        }
+        writeBatch(previous);
+        const Trailer trailer{offset, index.size(), {'H','N','C','Z'}, VERSION};
+        file.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size()*sizeof(BlockIndexEntry)));
+        file.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        if (!file) {
+            throw std::runtime_error("could not write compressed stream "+path);
+        }
+    }
+
+    /**
+     * Decompresses a block into place and checks it against its checksum
+     */
+    void decompressBlock(const std::uint64_t &block, std::uint8_t *out) const {
+        if (block >= blockCount) {
+            throw std::out_of_range("block is not in the compressed stream");
+        }
+        const BlockIndexEntry &entry = blockIndex[block];
+        if (entry.offset+entry.size > mappingSize) {
+            throw std::runtime_error("compressed block is outside of the stream");
+        }
+        decompress(mapping+entry.offset, entry.size, out, entry.rawSize);
+        if (fnv1a(out, entry.rawSize) != entry.checksum) {
+            throw std::runtime_error("compressed block "+std::to_string(block)+" does not match its checksum");
+        }
+    }
+};
+
+/**
+ * An export of the full trajectory of every number in a range, being each value it passes through until reaching 1 or
+ * repeating itself
+ *
+ * Every trajectory after its first step is the trajectory of a sum of digit squares, of which there are only
+ * maxDigitSquareSum()+1, so those tails are stored once in a table and each number only stores its first step
+ */
+class HnTrajectoryFile {
+public:
+    static constexpr std::uint32_t VERSION = 1;
+
+private:
+    struct Header {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t base;
+        std::uint64_t from;
+        std::uint64_t to;
+        std::uint64_t tails;
+    };
+
+    const std::uint8_t *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    Header header{};
+    const std::uint32_t *tailOffsets = nullptr;
+    const std::uint16_t *tailValues = nullptr;
+    const std::uint16_t *firstSteps = nullptr;
+
+public:
+    /**
+     * Maps a trajectory file into memory
+     *
+     * @param path Where the file was written by write
+     */
+    explicit HnTrajectoryFile(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("could not open trajectory file "+path);
+        }
+        struct stat info{};
+        if (fstat(fd, &info) == -1 || static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("trajectory file "+path+" is too small");
+        }
+        mappingSize = info.st_size;
+        void *address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("could not map trajectory file "+path);
+        }
+        mapping = static_cast<const std::uint8_t*>(address);
+        std::memcpy(&header, mapping, sizeof(header));
+        if (std::memcmp(header.magic, "HNTJ", 4) != 0 || header.version != VERSION) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("not a supported trajectory file "+path);
+        }
+        if (header.from > header.to || header.tails == 0 || header.tails > UINT16_MAX+1) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("trajectory file "+path+" has an invalid header");
+        }
+        // Each region is checked against what is left of the file before anything in it is read. The tail count is at
+        // most 2^16 and the values at most 2^32, so none of the sizes can overflow, and to-from+1 is never calculated
+        // since it wraps for a range covering every 64-bit number
+        std::uint64_t remaining = mappingSize-sizeof(Header);
+        const std::uint64_t offsetsSize = (header.tails+1)*sizeof(std::uint32_t);
+        if (offsetsSize > remaining) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("trajectory file "+path+" is truncated");
+        }
+        remaining -= offsetsSize;
+        tailOffsets = reinterpret_cast<const std::uint32_t*>(mapping+sizeof(Header));
+        // Every tail has at least one value, which isHappy relies on
+        bool offsetsValid = tailOffsets[0] == 0;
+        for (std::uint64_t tail = 0; tail < header.tails && offsetsValid; tail++) {
+            offsetsValid = tailOffsets[tail] < tailOffsets[tail+1];
+        }
+        if (!offsetsValid) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("trajectory file "+path+" has invalid tail offsets");
+        }
+        const std::uint64_t valuesSize = static_cast<std::uint64_t>(tailOffsets[header.tails])*sizeof(std::uint16_t);
+        if (valuesSize > remaining) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("trajectory file "+path+" is truncated");
+        }
+        remaining -= valuesSize;
+        tailValues = reinterpret_cast<const std::uint16_t*>(tailOffsets+header.tails+1);
+        if (header.to-header.from >= remaining/sizeof(std::uint16_t)) {
+            munmap(address, mappingSize);
+            throw std::runtime_error("trajectory file "+path+" is truncated");
+        }
+        firstSteps = tailValues+tailOffsets[header.tails];
+    }
+
+    HnTrajectoryFile(const HnTrajectoryFile&) = delete;
+    HnTrajectoryFile &operator=(const HnTrajectoryFile&) = delete;
+
+    ~HnTrajectoryFile() {
+        munmap(const_cast<std::uint8_t*>(mapping), mappingSize);
+    }
+
+    /**
+     * Gets the sum of digit squares of a number in the file
+     */
+    std::uint16_t firstStep(const std::uint64_t &n) const {
+        if (n < header.from || n > header.to) {
+            throw std::out_of_range("number is not in this trajectory file");
+        }
+        const std::uint16_t step = firstSteps[n-header.from];
+        // Only the regions are checked when the file is opened, so a step is checked to have a tail when it is used
+        if (step >= header.tails) {
+            throw std::runtime_error("trajectory file has a first step without a tail");
+        }
+        return step;
+    }
+
+    /**
+     * Expands the full trajectory of a number in the file
+     *
+     * @param n The number whose trajectory must be expanded
+     * @return n followed by every value it reaches, ending at 1 or at the first value to repeat
+     */
+    std::vector<std::uint64_t> trajectory(const std::uint64_t &n) const {
+        const std::uint16_t step = firstStep(n);
+        std::vector<std::uint64_t> values;
+        // A number small enough to be a sum of digit squares itself may be part of its own tail, so it has a tail of its own
+        const std::uint64_t tail = n < header.tails ? n : step;
+        if (tail != n) {
+            values.push_back(n);
+        }
+        values.insert(values.end(), tailValues+tailOffsets[tail], tailValues+tailOffsets[tail+1]);
+        return values;
+    }
+
+    /**
+     * Determines if a number in the file is happy from the end of its tail
+     */
+    bool isHappy(const std::uint64_t &n) const {
+        const std::uint16_t step = firstStep(n);
+        const std::uint64_t tail = n < header.tails ? n : step;
+        return tailValues[tailOffsets[tail+1]-1] == 1;
+    }
+
+    /**
+     * Writes the trajectory of every number in [from, to] as text, one line of values separated by arrows per number
+     *
+     * @param out Where to write the trajectories
+     * @param from The first number to write
+     * @param to The last number to write
+     */
+    void expand(std::ostream &out, const std::uint64_t &from, const std::uint64_t &to) const {
+        for (std::uint64_t n = std::max(from, header.from); n <= std::min(to, header.to); n++) {
+            const std::vector<std::uint64_t> values = trajectory(n);
+            std::string line = std::to_string(values[0]);
+            for (std::size_t i = 1; i < values.size(); i++) {
+                line += " -> "+std::to_string(values[i]);
+            }
+            line += '\n';
+            out << line;
+            if (n == UINT64_MAX) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * Writes the trajectories of every number in [from, to]
+     *
+     * @param calculator The calculator whose base the trajectories are in
+     * @param path Where to write the file
+     * @param from The first number of the range
+     * @param to The last number of the range
+     */
+    static void write(const HnCalculator &calculator, const std::string &path, const std::uint64_t &from, const std::uint64_t &to) {
+        const std::uint64_t tails = calculator.maxDigitSquareSum()+1;
+        if (tails > UINT16_MAX+1) {
+            throw std::invalid_argument("sums of digit squares in base "+std::to_string(calculator.base)+" do not fit in 16 bits");
+        }
+        std::vector<std::uint32_t> offsets{0};
+        std::vector<std::uint16_t> values;
+        for (std::uint64_t s = 0; s < tails; s++) {
+            const std::size_t start = values.size();
+            std::uint64_t value = s;
+            // Tails are short, so a linear search for repeats is quicker than a set
+            while (std::find(values.begin()+static_cast<std::ptrdiff_t>(start), values.end(), value) == values.end()) {
+                values.push_back(static_cast<std::uint16_t>(value));
+                if (value == 1) {
+                    break;
+                }
+                value = calculator.sumOfDigitSquares(value);
+            }
+            if (value != 1) {
+                values.push_back(static_cast<std::uint16_t>(value));
+            }
+            offsets.push_back(static_cast<std::uint32_t>(values.size()));
+        }
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const Header header{{'H','N','T','J'}, VERSION, static_cast<std::uint64_t>(calculator.base), from, to, tails};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size()*sizeof(std::uint32_t)));
+        file.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size()*sizeof(std::uint16_t)));
+        // First steps are found a chunk of digits at a time, as happyBitmap does
+        const std::vector<std::uint16_t> chunkTable = calculator.digitChunkTable();
+        const std::uint64_t chunkSize = chunkTable.size();
+        std::vector<std::uint16_t> steps;
+        steps.reserve(1 << 20);
+        for (std::uint64_t n = from; ; n++) {
+            std::uint64_t sum = 0;
+            for (std::uint64_t rest = n; rest > 0; rest /= chunkSize) {
+                sum += chunkTable[rest%chunkSize];
+            }
+            steps.push_back(static_cast<std::uint16_t>(sum));
+            if (steps.size() == steps.capacity() || n == to) {
+                file.write(reinterpret_cast<const char*>(steps.data()), static_cast<std::streamsize>(steps.size()*sizeof(std::uint16_t)));
+                steps.clear();
+            }
+            if (n == to) {
+                break;
+            }
+        }
+        if (!file) {
+            throw std::runtime_error("could not write trajectory file "+path);
+        }
+    }
+};
+
+/**
  * Test how long an HnCalculator takes to compute using the given number of threads
  *
  * This is useful for determining the most optimal number of threads to use on a given machine
@@ -241,6 +4949,251 @@ std::chrono::steady_clock::duration testThreads(HnCalculator &calculator, const
     return end-start;
 }
 
+/**
+ * Counts last-level cache misses of this process (including threads created after starting) using perf_event_open
+ */
+class HnPerfCounter {
+    int fd = -1;
+
+public:
+    HnPerfCounter() {
+        perf_event_attr attributes{};
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        attributes.disabled = 1;
+        attributes.inherit = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    HnPerfCounter(const HnPerfCounter&) = delete;
+    HnPerfCounter &operator=(const HnPerfCounter&) = delete;
+
+    ~HnPerfCounter() {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    /**
+     * Gets how many misses have been counted so far
+     *
+     * @return The number of misses, or nothing if the kernel does not allow counting them
+     */
+    std::optional<std::uint64_t> read() const {
+        std::uint64_t misses;
+        if (fd == -1 || ::read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+            return std::nullopt;
+        }
+        return misses;
+    }
+};
+
+/**
+ * Gets how much memory this process currently has resident
+ *
+ * @return VmRSS in bytes, or 0 if it is not reported
+ */
+std::uint64_t residentMemory() {
+    std::ifstream status("/proc/self/status");
+    for (std::string key; status >> key;) {
+        if (key == "VmRSS:") {
+            std::uint64_t kilobytes;
+            status >> kilobytes;
+            return kilobytes*1024;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Test how throughput changes as the range grows from 10^3 to 10^maxDecade, for each combination of calculator
+ * options and for happyBitmap
+ *
+ * Throughput, resident memory and last-level cache misses are output for each decade, and decades where throughput
+ * drops below half that of the previous decade are marked as cliffs
+ *
+ * @param maxDecade The power of 10 of the largest stopAt to test
+ * @param threads Number of threads to use for computation
+ */
+void testScaling(const std::uint16_t maxDecade, const char threads=1) {
+    const std::vector<std::pair<std::string,std::pair<bool,bool>>> modes = {
+        {"cache+skip", {true, true}},
+        {"cache", {true, false}},
+        {"skip", {false, true}},
+        {"none", {false, false}},
+        {"bitmap", {false, false}}
+    };
+    std::cout << "mode,stopAt,numbers/s,rss bytes,llc misses/number,cliff" << std::endl;
+    for (const auto &mode : modes) {
+        double previousThroughput = 0;
+        std::uint64_t stopAt = 100;
+        for (std::uint16_t decade = 3; decade <= maxDecade; decade++) {
+            stopAt *= 10;
+            const HnPerfCounter misses;
+            std::chrono::steady_clock::duration elapsedTime{};
+            std::uint64_t rss;
+            if (mode.first == "bitmap") {
+                // Bitmaps are built a chunk at a time so large decades do not need the whole range in memory
+                const HnCalculator calculator(false, false);
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (std::uint64_t from = 1; from <= stopAt; from += 1 << 24) {
+                    calculator.happyBitmap(from, std::min<std::uint64_t>(from+(1 << 24)-1, stopAt));
+                }
+                elapsedTime = std::chrono::steady_clock::now()-start;
+                rss = residentMemory();
+            } else {
+                HnCalculator calculator(mode.second.first, mode.second.second);
+                calculator.stopAt = stopAt;
+                calculator.outputResults = false;
+                elapsedTime = testThreads(calculator, threads);
+                rss = residentMemory();
+            }
+            const double seconds = std::chrono::duration<double>(elapsedTime).count();
+            const double throughput = static_cast<double>(stopAt)/std::max(seconds, 1e-9);
+            const std::optional<std::uint64_t> missCount = misses.read();
+            std::cout << mode.first << "," << stopAt << "," << static_cast<std::uint64_t>(throughput) << "," << rss << ",";
+            if (missCount) {
+                std::cout << static_cast<double>(missCount.value())/static_cast<double>(stopAt);
+            } else {
+                std::cout << "n/a";
+            }
+            std::cout << "," << (previousThroughput > 0 && throughput < previousThroughput/2 ? "cliff" : "") << std::endl;
+            previousThroughput = throughput;
+        }
+    }
+}
+
+/**
+ * Encodes results [from, to) of a result stream for one of the sinks tested by testSinks
+ *
+ * @param sink The name of the sink
+ * @param results The happiness of each number, with results[i] being for i+1
+ * @param from The index of the first result to encode
+ * @param to The index after the last result to encode
+ * @param buffer Where to encode the results, for sinks which are written a buffer at a time
+ * @param file Where to write the results, for sinks which write each result as it comes
+ * @return How many bytes were written straight to file
+ */
+std::uint64_t encodeForSink(const std::string &sink, const std::vector<bool> &results, const std::uint64_t &from,
+                            const std::uint64_t &to, std::vector<std::uint8_t> &buffer, std::FILE *file) {
+    std::uint64_t written = 0;
+    if (sink == "text") {
+        // The same as newResult, which formats each line on its own and writes it through the locked stdio stream
+        for (std::uint64_t i = from; i < to; i++) {
+            std::stringstream msg;
+            msg << i+1 << " is" << (results[i] ? "" : " not") << " happy" << std::endl;
+            const std::string line = msg.str();
+            written += std::fwrite(line.data(), 1, line.size(), file);
+        }
+    } else if (sink == "buffered text" || sink == "compressed") {
+        char digits[20];
+        for (std::uint64_t i = from; i < to; i++) {
+            char *end = std::to_chars(digits, digits+sizeof(digits), i+1).ptr;
+            buffer.insert(buffer.end(), digits, end);
+            const char *suffix = results[i] ? " is happy\n" : " is not happy\n";
+            buffer.insert(buffer.end(), suffix, suffix+std::strlen(suffix));
+        }
+        if (sink == "compressed") {
+            buffer = HnCompressedStream::compress(buffer);
+        }
+    } else if (sink == "bitmap") {
+        buffer.assign((to-from+7)/8, 0);
+        for (std::uint64_t i = from; i < to; i++) {
+            buffer[(i-from)/8] |= static_cast<std::uint8_t>(results[i] << ((i-from)%8));
+        }
+    } else if (sink == "delta-varint") {
+        std::uint64_t previous = from;
+        for (std::uint64_t i = from; i < to; i++) {
+            if (results[i]) {
+                appendVarint(buffer, i+1-previous);
+                previous = i+1;
+            }
+        }
+    }
+    return written;
+}
+
+/**
+ * Test the throughput of each way of outputting results, isolated from calculating them
+ *
+ * A stream of results is calculated up front, then each sink is driven by increasing numbers of threads, which each
+ * encode part of every chunk of the stream. Buffered sinks are written a chunk at a time in order, and every file is
+ * synced to its device before the timer stops, so that slow disks are not hidden by the page cache
+ *
+ * @param directories Where to write the output of each sink, such as a tmpfs and a real disk
+ * @param numbers How many results the stream holds
+ */
+void testSinks(const std::vector<std::string> &directories, const std::uint64_t &numbers) {
+    constexpr std::uint64_t chunkSize = 1 << 22;
+    const std::vector<bool> results = HnCalculator(false, false).happyBitmap(1, numbers);
+    const std::vector<std::string> sinks = {"text", "buffered text", "bitmap", "delta-varint", "compressed", "null"};
+    std::cout << "sink,directory,threads,MB/s,numbers/s" << std::endl;
+    for (const std::string &directory : directories) {
+        if (access(directory.c_str(), W_OK) != 0) {
+            std::cerr << "Skipping " << directory << " since it cannot be written to" << std::endl;
+            continue;
+        }
+        const std::string path = directory+"/happy-numbers-sink-benchmark";
+        for (const std::string &sink : sinks) {
+            for (std::uint16_t threads = 1; threads <= HnResources::threads(); threads *= 2) {
+                std::FILE *file = std::fopen(path.c_str(), "wb");
+                if (file == nullptr) {
+                    throw std::runtime_error("could not create "+path);
+                }
+                std::uint64_t bytes = 0;
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (std::uint64_t chunkFrom = 0; chunkFrom < numbers; chunkFrom += chunkSize) {
+                    const std::uint64_t chunkTo = std::min(numbers, chunkFrom+chunkSize);
+                    std::vector<std::vector<std::uint8_t>> buffers(threads);
+                    std::vector<std::uint64_t> written(threads, 0);
+                    std::vector<std::thread> workers;
+                    for (std::uint16_t t = 0; t < threads; t++) {
+                        workers.emplace_back([&, t] {
+                            // Parts start on whole bytes of the bitmap
+                            const std::uint64_t partFrom = chunkFrom+(chunkTo-chunkFrom)*t/threads/8*8;
+                            const std::uint64_t partTo = t+1 == threads ? chunkTo : chunkFrom+(chunkTo-chunkFrom)*(t+1)/threads/8*8;
+                            if (sink != "null") {
+                                written[t] = encodeForSink(sink, results, partFrom, partTo, buffers[t], file);
+                            }
+                        });
+                    }
+                    for (std::uint16_t t = 0; t < threads; t++) {
+                        workers[t].join();
+                        bytes += written[t]+std::fwrite(buffers[t].data(), 1, buffers[t].size(), file);
+                    }
+                }
+                std::fflush(file);
+                fsync(fileno(file));
+                std::fclose(file);
+                const double seconds = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count(), 1e-9);
+                std::remove(path.c_str());
+                std::cout << sink << "," << directory << "," << threads << "," << static_cast<double>(bytes)/1e6/seconds << ","
+                          << static_cast<std::uint64_t>(static_cast<double>(numbers)/seconds) << std::endl;
+            }
+        }
+    }
+}
+
+#ifdef HN_BENCHMARK
+int main(const int argc, const char *argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "sinks") {
+        std::vector<std::string> directories(argv+std::min(argc, 3), argv+argc);
+        if (directories.empty()) {
+            directories = {"/dev/shm", "."};
+        }
+        testSinks(directories, argc > 2 ? std::stoull(argv[2]) : 1 << 24);
+        return 0;
+    }
+    testScaling(argc > 1 ? static_cast<std::uint16_t>(std::stoul(argv[1])) : 11);
+}
+#else
 int main() {
     auto calculator = HnCalculator();
     calculator.stopAt = 2000000000;
@@ -249,3 +5202,4 @@ int main() {
     const std::chrono::steady_clock::duration elapsedTime = testThreads(calculator, 1);
     std::cout << "Elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsedTime).count() << " milliseconds";
 }
+#endif